@@ -8,6 +8,10 @@
 #include "vec3.h"
 #include "ray.h"
 
+// the far distance of every slab is scaled by this so rounding errors never make a ray miss a box it grazes
+// (1 + 2 * gamma(3) as in *Physically Based Rendering*)
+const float aabb_far_scale = 1.0000004f;
+
 // class declaration of aabb
 class aabb
 {
@@ -26,6 +30,35 @@ public:
     vec3 min()const{ return  _min;}
     vec3 max()const{ return  _max;}
 
+    // slab test: does the ray pass through the box between t_min and t_max
+    inline bool hit(const ray &r, float t_min, float t_max) const {
+        for (int a = 0; a < 3; a++) {
+            float invD = 1.0f / r.direction()[a];
+            float t0 = (_min[a] - r.origin()[a]) * invD;
+            float t1 = (_max[a] - r.origin()[a]) * invD;
+            if (invD < 0.0f) {
+                float temp = t0;
+                t0 = t1;
+                t1 = temp;
+            }
+            t_min = t0 > t_min ? t0 : t_min;
+            t1 *= aabb_far_scale;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min)
+                return false;
+        }
+        return true;
+    }
+
+    // surface area of the box, used by the surface area heuristic
+    inline float area() const {
+        vec3 d = _max - _min;
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    // center of the box
+    inline vec3 centroid() const { return 0.5 * (_min + _max); }
+
 };
 
 //calculates the compound minimal bounding box, works like convex hull
@@ -15,9 +15,13 @@ public:
     xy_rect() {}
     xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material *mat) : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
     virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
     virtual bool bounding_box(float t0, float t1, aabb& box) const {
         box =  aabb(vec3(x0,y0, k-0.0001), vec3(x1, y1, k+0.0001));
         return true; }
+    virtual void complete(const ray& r, hit_record& rec) const;
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const;
+    virtual vec3 random(const vec3 &o, sampler &rng) const;
     material  *mp;
     float x0, x1, y0, y1, k;
 };
@@ -28,9 +32,13 @@ public:
     xz_rect() {}
     xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material *mat) : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
     virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
     virtual bool bounding_box(float t0, float t1, aabb& box) const {
         box =  aabb(vec3(x0,k-0.0001,z0), vec3(x1, k+0.0001, z1));
         return true; }
+    virtual void complete(const ray& r, hit_record& rec) const;
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const;
+    virtual vec3 random(const vec3 &o, sampler &rng) const;
     material  *mp;
     float x0, x1, z0, z1, k;
 };
@@ -41,15 +49,55 @@ public:
     yz_rect() {}
     yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material *mat) : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
     virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
     virtual bool bounding_box(float t0, float t1, aabb& box) const {
         box =  aabb(vec3(k-0.0001, y0, z0), vec3(k+0.0001, y1, z1));
         return true; }
+    virtual void complete(const ray& r, hit_record& rec) const;
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const;
+    virtual vec3 random(const vec3 &o, sampler &rng) const;
     material  *mp;
     float y0, y1, z0, z1, k;
 };
 
 
 
+// hit() of an axis aligned rectangle for the lanes of a packet. The rectangle lies in the plane where axis k is
+// k_value and covers [a0, a1] x [b0, b1] of the axes a and b. The distances and coordinates of all lanes are found in
+// one branch free loop, the records are only set for the lanes that hit
+inline int rect_hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h, int k, int a, int b,
+                           float k_value, float a0, float a1, float b0, float b1, const hitable *object) {
+    float t[packet_size];
+    int hit[packet_size];
+    for (int l = 0; l < packet_size; l++) {
+        float tl = (k_value - p.origin[k][l]) / p.direction[k][l];
+        float x = p.origin[a][l] + tl * p.direction[a][l];
+        float y = p.origin[b][l] + tl * p.direction[b][l];
+        t[l] = tl;
+        // bitwise instead of logical operators, so the loop has no branches
+        hit[l] = !((tl < t_min) | (tl > h.t[l]) | (x < a0) | (x > a1) | (y < b0) | (y > b1));
+    }
+    int result = packet_mask(hit, mask);
+    for (int l = 0; l < packet_size; l++) {
+        if (!(result & (1 << l)))
+            continue;
+        h.rec[l].t = t[l];
+        h.rec[l].object = object;
+        h.t[l] = t[l];
+    }
+    return result;
+}
+
+// the point, normal and uv of a hit of an axis aligned rectangle, laid out as in rect_hit_packet()
+inline void rect_complete(const ray &r, hit_record &rec, int a, int b, float a0, float a1, float b0, float b1,
+                          material *mp, const vec3 &normal) {
+    rec.p = r.point_at_parameter(rec.t);
+    rec.u = (rec.p[a] - a0) / (a1 - a0);
+    rec.v = (rec.p[b] - b0) / (b1 - b0);
+    rec.mat_ptr = mp;
+    rec.normal = normal;
+}
+
 // Compute whether a ray hits an xy_rect
 bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     float t = (k-r.origin().z()) / r.direction().z();
@@ -59,15 +107,16 @@ bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     float y = r.origin().y() + t*r.direction().y();
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
-    rec.u = (x-x0)/(x1-x0);
-    rec.v = (y-y0)/(y1-y0);
     rec.t = t;
-    rec.mat_ptr = mp;
-    rec.p = r.point_at_parameter(t);
-    rec.normal = vec3(0, 0, 1);
+    rec.object = this;
     return true;
 }
 
+// Complete the closest hit of an xy_rect
+void xy_rect::complete(const ray& r, hit_record& rec) const {
+    rect_complete(r, rec, 0, 1, x0, x1, y0, y1, mp, vec3(0, 0, 1));
+}
+
 // Compute whether a ray hits an xz_rect
 bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     float t = (k-r.origin().y()) / r.direction().y();
@@ -77,15 +126,16 @@ bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     float z = r.origin().z() + t*r.direction().z();
     if (x < x0 || x > x1 || z < z0 || z > z1)
         return false;
-    rec.u = (x-x0)/(x1-x0);
-    rec.v = (z-z0)/(z1-z0);
     rec.t = t;
-    rec.mat_ptr = mp;
-    rec.p = r.point_at_parameter(t);
-    rec.normal = vec3(0, 1, 0);
+    rec.object = this;
     return true;
 }
 
+// Complete the closest hit of an xz_rect
+void xz_rect::complete(const ray& r, hit_record& rec) const {
+    rect_complete(r, rec, 0, 2, x0, x1, z0, z1, mp, vec3(0, 1, 0));
+}
+
 // Compute whether a ray hits an yz_rect
 bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     float t = (k-r.origin().x()) / r.direction().x();
@@ -95,13 +145,79 @@ bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     float z = r.origin().z() + t*r.direction().z();
     if (y < y0 || y > y1 || z < z0 || z > z1)
         return false;
-    rec.u = (y-y0)/(y1-y0);
-    rec.v = (z-z0)/(z1-z0);
     rec.t = t;
-    rec.mat_ptr = mp;
-    rec.p = r.point_at_parameter(t);
-    rec.normal = vec3(1, 0, 0);
+    rec.object = this;
     return true;
 }
 
+// Complete the closest hit of an yz_rect
+void yz_rect::complete(const ray& r, hit_record& rec) const {
+    rect_complete(r, rec, 1, 2, y0, y1, z0, z1, mp, vec3(1, 0, 0));
+}
+
+// Compute which rays of a packet hit an xy_rect
+int xy_rect::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    return rect_hit_packet(p, mask, t_min, h, 2, 0, 1, k, x0, x1, y0, y1, this);
+}
+
+// Compute which rays of a packet hit an xz_rect
+int xz_rect::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    return rect_hit_packet(p, mask, t_min, h, 1, 0, 2, k, x0, x1, z0, z1, this);
+}
+
+// Compute which rays of a packet hit an yz_rect
+int yz_rect::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    return rect_hit_packet(p, mask, t_min, h, 0, 1, 2, k, y0, y1, z0, z1, this);
+}
+
+// the density of a point picked uniformly on a rectangle, converted from per unit area to per unit solid angle
+// t is the distance along v at which the rectangle was hit, normal its normal
+inline float rect_pdf_value(const vec3 &v, float t, const vec3 &normal, float area) {
+    float distance_squared = t * t * dot(v, v);
+    float cosine = fabs(dot(v, normal) / v.length());
+    return distance_squared / (cosine * area);
+}
+
+// density of xy_rect::random picking direction v from o
+float xy_rect::pdf_value(const vec3 &o, const vec3 &v) const {
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, MAXFLOAT, rec))
+        return 0;
+    return rect_pdf_value(v, rec.t, vec3(0, 0, 1), (x1 - x0) * (y1 - y0));
+}
+
+// a direction from o to a uniformly random point of the xy_rect
+vec3 xy_rect::random(const vec3 &o, sampler &rng) const {
+    vec3 random_point = vec3(x0 + rng.next() * (x1 - x0), y0 + rng.next() * (y1 - y0), k);
+    return random_point - o;
+}
+
+// density of xz_rect::random picking direction v from o
+float xz_rect::pdf_value(const vec3 &o, const vec3 &v) const {
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, MAXFLOAT, rec))
+        return 0;
+    return rect_pdf_value(v, rec.t, vec3(0, 1, 0), (x1 - x0) * (z1 - z0));
+}
+
+// a direction from o to a uniformly random point of the xz_rect
+vec3 xz_rect::random(const vec3 &o, sampler &rng) const {
+    vec3 random_point = vec3(x0 + rng.next() * (x1 - x0), k, z0 + rng.next() * (z1 - z0));
+    return random_point - o;
+}
+
+// density of yz_rect::random picking direction v from o
+float yz_rect::pdf_value(const vec3 &o, const vec3 &v) const {
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, MAXFLOAT, rec))
+        return 0;
+    return rect_pdf_value(v, rec.t, vec3(1, 0, 0), (y1 - y0) * (z1 - z0));
+}
+
+// a direction from o to a uniformly random point of the yz_rect
+vec3 yz_rect::random(const vec3 &o, sampler &rng) const {
+    vec3 random_point = vec3(k, y0 + rng.next() * (y1 - y0), z0 + rng.next() * (z1 - z0));
+    return random_point - o;
+}
+
 #endif //AARECT_H
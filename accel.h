@@ -0,0 +1,117 @@
+// This file contains the choice of acceleration structure the scene is wrapped in
+// All of them are hitables, so the renderer does not need to know which one is in use
+
+#ifndef ACCEL_H
+#define ACCEL_H
+
+#include <string.h>
+#include <algorithm>
+#include "hitable_list.h"
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+#include "lazy_bvh.h"
+#include "instance.h"
+#include "arena.h"
+
+// the available acceleration structures
+enum accel_type {
+    ACCEL_LIST,         // no acceleration, test every object
+    ACCEL_BVH,          // tree of bvh_node objects
+    ACCEL_LINEAR_BVH,   // flattened bvh in one array
+    ACCEL_BVH4,         // 4 wide bvh tested with SSE
+    ACCEL_BVH8,         // 8 wide bvh tested with AVX2
+    ACCEL_LAZY          // binary bvh split while rays reach its nodes
+};
+
+// the fastest structure for the instruction set the renderer was compiled for
+#ifdef WIDE_BVH_AVX2
+const accel_type default_accel = ACCEL_BVH8;
+#else
+const accel_type default_accel = ACCEL_BVH4;
+#endif
+
+// the tree of the given type over the n hitables in l, every one of which has a bounding box. See build_accel()
+hitable *build_tree(hitable **l, int n, accel_type type, float time0, float time1, arena &storage,
+                    bvh_builder builder, bvh_build_stats *stats, thread_pool *threads) {
+    switch (type) {
+        case ACCEL_LIST:
+            return storage.make<hitable_list>(l, n);
+        case ACCEL_BVH:
+            return storage.make<bvh_node>(l, n, time0, time1, storage);
+        case ACCEL_LAZY: {
+            lazy_bvh *tree = storage.make<lazy_bvh>(l, n, time0, time1);
+            storage.add_external(tree->memory());
+            return tree;
+        }
+        case ACCEL_BVH4: {
+            wide_bvh<4> *tree = storage.make<wide_bvh<4> >(l, n, time0, time1, builder, threads);
+            storage.add_external(tree->memory());
+            if (stats != NULL)
+                *stats = tree->stats;
+            return tree;
+        }
+        case ACCEL_BVH8: {
+            wide_bvh<8> *tree = storage.make<wide_bvh<8> >(l, n, time0, time1, builder, threads);
+            storage.add_external(tree->memory());
+            if (stats != NULL)
+                *stats = tree->stats;
+            return tree;
+        }
+        default: {
+            linear_bvh *tree = storage.make<linear_bvh>(l, n, time0, time1, builder, threads);
+            storage.add_external(tree->memory());
+            if (stats != NULL)
+                *stats = tree->stats;
+            return tree;
+        }
+    }
+}
+
+// build the acceleration structure of the given type over the n hitables in l, in storage. The flat trees are built
+// with builder, on threads if it is not NULL, and how that went is stored in stats if it is not NULL. The lazy tree
+// always splits with the binned surface area heuristic and leaves stats alone
+// Chains of transforms in l are folded into single instances first. A tree can only hold objects with a bounding box,
+// the others are kept in a list next to it and tested by every ray. l is reordered, bounded objects first
+hitable *build_accel(hitable **l, int n, accel_type type, float time0, float time1, arena &storage,
+                     bvh_builder builder = default_bvh_builder, bvh_build_stats *stats = NULL,
+                     thread_pool *threads = NULL) {
+    for (int i = 0; i < n; i++)
+        l[i] = fold_transforms(l[i], storage);
+    if (type == ACCEL_LIST)
+        return storage.make<hitable_list>(l, n);
+    int bounded = int(std::stable_partition(l, l + n, [=](hitable *h) {
+        aabb box;
+        return h->bounding_box(time0, time1, box);
+    }) - l);
+    if (bounded == n)
+        return build_tree(l, n, type, time0, time1, storage, builder, stats, threads);
+    hitable **list = storage.make_array<hitable *>(n - bounded + 1);
+    int count = 0;
+    if (bounded > 0)
+        list[count++] = build_tree(l, bounded, type, time0, time1, storage, builder, stats, threads);
+    for (int i = bounded; i < n; i++)
+        list[count++] = l[i];
+    return storage.make<hitable_list>(list, count);
+}
+
+// parse the name of an acceleration structure. Returns false for an unknown name
+bool parse_accel(const char *name, accel_type &type) {
+    if (strcmp(name, "list") == 0)
+        type = ACCEL_LIST;
+    else if (strcmp(name, "bvh") == 0)
+        type = ACCEL_BVH;
+    else if (strcmp(name, "linear") == 0)
+        type = ACCEL_LINEAR_BVH;
+    else if (strcmp(name, "bvh4") == 0)
+        type = ACCEL_BVH4;
+    else if (strcmp(name, "bvh8") == 0)
+        type = ACCEL_BVH8;
+    else if (strcmp(name, "lazy") == 0)
+        type = ACCEL_LAZY;
+    else
+        return false;
+    return true;
+}
+
+#endif //ACCEL_H
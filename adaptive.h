@@ -0,0 +1,82 @@
+// This file contains adaptive sampling
+// Every pixel keeps a running estimate of its mean and variance and is sampled in batches until the relative
+// standard error of its mean drops under a threshold, so flat wall pixels stop long before pixels behind glass
+// Refer to the documentation for technical and mathematical details
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <math.h>
+#include "vec3.h"
+
+// when a pixel is done
+struct adaptive_settings {
+    int min_samples;            // samples taken before the error is looked at
+    int max_samples;            // samples after which a pixel stops regardless of its error
+    int batch;                  // samples taken between two checks of the error
+    float max_relative_error;   // standard error of the mean divided by the mean
+};
+
+// perceived brightness of a color, the quantity whose error is estimated
+inline float luminance(const vec3 &c) {
+    return 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+}
+
+// running estimate of one pixel (Welford's algorithm for the variance of the luminance)
+struct pixel_estimate {
+    pixel_estimate() : samples(0), mean(0), m2(0) {
+        sum[0] = sum[1] = sum[2] = 0;
+    }
+
+    // add one sample
+    void add(const vec3 &c) {
+        samples++;
+        for (int i = 0; i < 3; i++)
+            sum[i] += c[i];
+        double y = luminance(c);
+        double delta = y - mean;
+        mean += delta / samples;
+        m2 += delta * (y - mean);
+    }
+
+    // standard error of the mean luminance relative to the mean
+    double relative_error() const {
+        if (samples < 2)
+            return HUGE_VAL;
+        double standard_error = sqrt(m2 / (samples - 1) / samples);
+        if (standard_error == 0)
+            return 0;
+        return mean > 0 ? standard_error / mean : HUGE_VAL;
+    }
+
+    // whether the pixel needs no more samples
+    bool done(const adaptive_settings &settings) const {
+        if (samples >= settings.max_samples)
+            return true;
+        return samples >= settings.min_samples && relative_error() <= settings.max_relative_error;
+    }
+
+    // the average color
+    vec3 color() const {
+        if (samples == 0)
+            return vec3(0, 0, 0);
+        return vec3(sum[0] / samples, sum[1] / samples, sum[2] / samples);
+    }
+
+    int samples;
+    double mean;
+    double m2;
+    double sum[3];
+};
+
+// color of a sample count in the heatmap, from black (min_samples) over red and yellow to white (max_samples)
+vec3 heatmap_color(int samples, const adaptive_settings &settings) {
+    float t = 0;
+    if (settings.max_samples > settings.min_samples && samples > settings.min_samples)
+        t = log(float(samples) / settings.min_samples) / log(float(settings.max_samples) / settings.min_samples);
+    t = t > 1 ? 1 : t;
+    float r = 3 * t, g = 3 * t - 1, b = 3 * t - 2;
+    return vec3(r > 1 ? 1 : r, g < 0 ? 0 : (g > 1 ? 1 : g), b < 0 ? 0 : b);
+}
+
+#endif //ADAPTIVE_H
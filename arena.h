@@ -0,0 +1,119 @@
+// This file contains the arena the objects of a scene are allocated from
+// A scene is many small objects, hitables, materials, textures and bvh nodes, that all live exactly as long as the
+// scene. The arena hands out memory from large blocks one piece after the other, so objects made one after the
+// other lie next to each other in memory, and frees all of them at once when it is destroyed or cleared. Objects
+// that own memory of their own, like the node arrays of a flat bvh, are destroyed with it
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <stdlib.h>
+#include <new>
+#include <utility>
+#include <vector>
+#include <type_traits>
+
+class arena {
+public:
+    // memory is taken from the system in blocks of block_size bytes, larger allocations get a block of their own
+    explicit arena(size_t block_size = 64 * 1024) : block_size(block_size), current(NULL), left(0), used(0),
+                                                     reserved(0), objects(0), external(0) {}
+
+    ~arena() { clear(); }
+
+    // size bytes aligned to alignment, which must be a power of two
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    // construct a T in the arena. It is destroyed together with the arena
+    template<class T, class... Args>
+    T *make(Args &&... args) {
+        T *object = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+            destructors.push_back(cleanup(&destroy<T>, object));
+        objects++;
+        return object;
+    }
+
+    // an array of n value initialized T, for the pointer arrays of lists and trees
+    template<class T>
+    T *make_array(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arrays in the arena are never destroyed");
+        T *array = static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
+        for (size_t i = 0; i < n; i++)
+            new(array + i) T();
+        return array;
+    }
+
+    // count bytes that objects of the arena own outside of it, so they show up in the memory use of the scene
+    void add_external(size_t bytes) { external += bytes; }
+
+    // destroy every object and free all memory. The arena can be used again afterwards
+    void clear();
+
+    size_t bytes_used() const { return used; }          // handed out to objects
+    size_t bytes_reserved() const { return reserved; }  // taken from the system
+    size_t bytes_external() const { return external; }  // see add_external()
+    size_t object_count() const { return objects; }     // made with make()
+
+private:
+    arena(const arena &);
+
+    arena &operator=(const arena &);
+
+    template<class T>
+    static void destroy(void *object) { static_cast<T *>(object)->~T(); }
+
+    typedef std::pair<void (*)(void *), void *> cleanup;
+
+    size_t block_size;
+    char *current;      // free memory of the block in use
+    size_t left;        // bytes left after current
+    size_t used;
+    size_t reserved;
+    size_t objects;
+    size_t external;
+    std::vector<char *> blocks;
+    std::vector<cleanup> destructors;
+};
+
+void *arena::allocate(size_t size, size_t alignment) {
+    size_t padding = (alignment - reinterpret_cast<size_t>(current) % alignment) % alignment;
+    if (current == NULL || padding + size > left) {
+        // large allocations get a block of their own, so the block in use keeps its free space
+        bool own_block = size + alignment > block_size;
+        size_t bytes = own_block ? size + alignment : block_size;
+        char *block = static_cast<char *>(malloc(bytes));
+        if (block == NULL)
+            throw std::bad_alloc();
+        blocks.push_back(block);
+        reserved += bytes;
+        padding = (alignment - reinterpret_cast<size_t>(block) % alignment) % alignment;
+        if (own_block) {
+            used += size;
+            return block + padding;
+        }
+        current = block;
+        left = bytes;
+    }
+    void *result = current + padding;
+    current += padding + size;
+    left -= padding + size;
+    used += size;
+    return result;
+}
+
+void arena::clear() {
+    // objects can point at objects made before them, so they go in reverse order
+    for (size_t i = destructors.size(); i-- > 0;)
+        destructors[i].first(destructors[i].second);
+    for (size_t i = 0; i < blocks.size(); i++)
+        free(blocks[i]);
+    destructors.clear();
+    blocks.clear();
+    current = NULL;
+    left = 0;
+    used = reserved = objects = external = 0;
+}
+
+#endif //ARENA_H
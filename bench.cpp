@@ -0,0 +1,193 @@
+// Ray throughput benchmark of the acceleration structures
+// Measures closest-hit rays per second on the scene() Cornell set-up and on a stress scene of random spheres, with
+// every ray traced on its own and in packets of consecutive rays, and compares the trees of the bvh builders
+// The vec3 math alone is timed as well, build with -DRAY_TRACER_SIMD_VEC3=ON to compare the SSE vec3
+// Usage: ./Ray_Tracer_bench [sphere count]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "scene.h"
+#include "camera.h"
+
+using namespace std;
+
+// seconds elapsed since start
+double seconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// n small spheres scattered through a 1000 unit cube, made in storage. The tree is built on threads
+hitable *stress_scene(int n, accel_type accel, arena &storage, thread_pool &threads,
+                      bvh_builder builder = default_bvh_builder, bvh_build_stats *stats = NULL) {
+    hitable **list = storage.make_array<hitable *>(n);
+    material *mat = storage.make<lambertian>(storage.make<constant_texture>(vec3(0.5, 0.5, 0.5)));
+    for (int i = 0; i < n; i++) {
+        vec3 center(1000 * drand48(), 1000 * drand48(), 1000 * drand48());
+        list[i] = storage.make<sphere>(center, 0.5 + 2 * drand48(), mat);
+    }
+    return build_accel(list, n, accel, 0.0, 1.0, storage, builder, stats, &threads);
+}
+
+// one ray per pixel of a camera
+void primary_rays(camera &cam, int nx, int ny, vector<ray> &rays) {
+    sampler rng;
+    for (int j = 0; j < ny; j++)
+        for (int i = 0; i < nx; i++)
+            rays.push_back(cam.get_ray(float(i + rng.next()) / float(nx), float(j + rng.next()) / float(ny), rng));
+}
+
+// rays from random points in a box into random directions, like diffuse bounces
+void incoherent_rays(const vec3 &lo, const vec3 &hi, int n, vector<ray> &rays) {
+    sampler rng(1, 0);
+    for (int i = 0; i < n; i++) {
+        vec3 o = lo + vec3(rng.next(), rng.next(), rng.next()) * (hi - lo);
+        rays.push_back(ray(o, random_in_unit_sphere(rng)));
+    }
+}
+
+// trace all rays, with the records of their closest hits filled in, and print the throughput
+void measure(const char *scene_name, const char *accel_name, const char *ray_name, hitable *world,
+             const vector<ray> &rays) {
+    hit_record rec;
+    int hits = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < rays.size(); i++)
+        hits += closest_hit(world, rays[i], 0.001, MAXFLOAT, rec);
+    double t = seconds_since(start);
+    printf("%-8s %-8s %-11s %8.2f Mrays/s  (%d hits)\n", scene_name, accel_name, ray_name,
+           rays.size() / t / 1e6, hits);
+}
+
+// trace all rays in packets of consecutive rays and print the throughput
+void measure_packets(const char *scene_name, const char *accel_name, const char *ray_name, hitable *world,
+                     const vector<ray> &rays) {
+    packet_hits h;
+    ray_packet p;
+    int hits = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i + packet_size <= rays.size(); i += packet_size) {
+        for (int l = 0; l < packet_size; l++) {
+            p.set(l, rays[i + l]);
+            h.t[l] = MAXFLOAT;
+        }
+        int found = world->hit_packet(p, packet_all, 0.001, h);
+        complete_packet(p, found, h);
+        hits += __builtin_popcount(found);
+    }
+    double t = seconds_since(start);
+    printf("%-8s %-8s %-11s %8.2f Mrays/s  (%d hits, packets of %d)\n", scene_name, accel_name, ray_name,
+           rays.size() / t / 1e6, hits, packet_size);
+}
+
+// best time of five runs of f, in nanoseconds per call over n calls
+template<class F>
+double best_ns(int n, F f) {
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) {
+        auto start = chrono::steady_clock::now();
+        f();
+        double t = seconds_since(start);
+        best = t < best ? t : best;
+    }
+    return best / n * 1e9;
+}
+
+// the vec3 math of the renderer on its own: camera rays, sphere hits and the reflections and refractions of glass
+void measure_math(camera &cam) {
+    const int n = 1 << 20;
+    vector<ray> rays;
+    rays.reserve(n);
+    primary_rays(cam, 1024, 1024, rays);
+    sphere ball(vec3(500, 500, 500), 300, NULL);
+    volatile float sink = 0;
+
+    double camera_ns = best_ns(n, [&]() {
+        sampler rng(2, 0);
+        vec3 sum(0, 0, 0);
+        for (int i = 0; i < n; i++)
+            sum += cam.get_ray(rng.next(), rng.next(), rng).direction();
+        sink = sum.x();
+    });
+    double sphere_ns = best_ns(n, [&]() {
+        hit_record rec;
+        float sum = 0;
+        for (int i = 0; i < n; i++)
+            if (closest_hit(&ball, rays[i], 0.001, MAXFLOAT, rec))
+                sum += rec.t + rec.u + rec.v + rec.normal.x() + rec.p.y();
+        sink = sum;
+    });
+    double glass_ns = best_ns(n, [&]() {
+        vec3 sum(0, 0, 0);
+        vec3 normal = unit_vector(vec3(0.3, 1, 0.2));
+        for (int i = 0; i < n; i++) {
+            vec3 refracted;
+            if (refract(rays[i].direction(), normal, 1 / 1.5f, refracted))
+                sum += refracted;
+            sum += reflect(rays[i].direction(), normal);
+        }
+        sink = sum.x();
+    });
+#ifdef VEC3_SSE
+    const char *kind = "sse";
+#else
+    const char *kind = "scalar";
+#endif
+    printf("%-8s %-8s camera %.2f ns, sphere hit %.2f ns, reflect+refract %.2f ns\n", "math", kind, camera_ns,
+           sphere_ns, glass_ns);
+}
+
+int main(int argc, char **argv) {
+    int sphere_count = argc > 1 ? atoi(argv[1]) : 1000000;
+    const char *names[] = {"bvh", "linear", "bvh4", "bvh8"};
+    accel_type types[] = {ACCEL_BVH, ACCEL_LINEAR_BVH, ACCEL_BVH4, ACCEL_BVH8};
+
+    // the Cornell set-up with the camera from main.cpp
+    camera cam(vec3(500, 500, -1300), vec3(500, 500, 1000), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1);
+    measure_math(cam);
+    vector<ray> cornell_primary, cornell_incoherent;
+    primary_rays(cam, 1024, 1024, cornell_primary);
+    incoherent_rays(vec3(0, 0, -1300), vec3(1000, 1000, 1000), 1 << 20, cornell_incoherent);
+    for (int a = 0; a < 4; a++) {
+        arena storage;
+        hitable *world = scene(storage, types[a]).world;
+        measure("cornell", names[a], "primary", world, cornell_primary);
+        measure_packets("cornell", names[a], "primary", world, cornell_primary);
+        measure("cornell", names[a], "incoherent", world, cornell_incoherent);
+        measure_packets("cornell", names[a], "incoherent", world, cornell_incoherent);
+    }
+
+    // the stress scene, seen from outside and from inside
+    camera stress_cam(vec3(500, 500, -1500), vec3(500, 500, 500), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1);
+    vector<ray> stress_primary, stress_incoherent;
+    thread_pool pool;
+    primary_rays(stress_cam, 1024, 1024, stress_primary);
+    incoherent_rays(vec3(0, 0, 0), vec3(1000, 1000, 1000), 1 << 20, stress_incoherent);
+    for (int a = 0; a < 4; a++) {
+        srand48(1);
+        auto start = chrono::steady_clock::now();
+        arena storage;
+        hitable *world = stress_scene(sphere_count, types[a], storage, pool);
+        printf("%-8s %-8s build %.2f s, %.1f MiB\n", "spheres", names[a], seconds_since(start),
+               (storage.bytes_reserved() + storage.bytes_external()) / (1024.0 * 1024.0));
+        measure("spheres", names[a], "primary", world, stress_primary);
+        measure_packets("spheres", names[a], "primary", world, stress_primary);
+        measure("spheres", names[a], "incoherent", world, stress_incoherent);
+        measure_packets("spheres", names[a], "incoherent", world, stress_incoherent);
+    }
+
+    // the builders, on the stress scene in the fastest structure
+    const char *builder_names[] = {"sweep", "binned", "lbvh"};
+    bvh_builder builders[] = {BVH_BUILD_SWEEP, BVH_BUILD_BINNED, BVH_BUILD_LBVH};
+    for (int b = 0; b < 3; b++) {
+        srand48(1);
+        arena storage;
+        bvh_build_stats stats;
+        hitable *world = stress_scene(sphere_count, default_accel, storage, pool, builders[b], &stats);
+        printf("%-8s %-8s build %.2f s, SAH cost %.2f, %d nodes\n", "spheres", builder_names[b], stats.seconds,
+               stats.sah_cost, stats.nodes);
+        measure("spheres", builder_names[b], "primary", world, stress_primary);
+        measure("spheres", builder_names[b], "incoherent", world, stress_incoherent);
+    }
+}
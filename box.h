@@ -4,38 +4,153 @@
 #ifndef BOX_H
 #define BOX_H
 
-#include "aarect.h"
-#include "hitable_list.h"
+#include "hitable.h"
 
+// The faces of a box are numbered 2 * axis for the one at pmin and 2 * axis + 1 for the one at pmax, so -x, +x, -y,
+// +y, -z and +z
 class box: public hitable  {
 public:
     box() {}
-    box(const vec3& p0, const vec3& p1, material *ptr);
+    box(const vec3& p0, const vec3& p1, material *ptr) : pmin(p0), pmax(p1), mp(ptr) {}
     virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
     virtual bool bounding_box(float t0, float t1, aabb& box) const {
         box =  aabb(pmin, pmax);
         return true; }
-    vec3 pmin, pmax;
-    hitable *list_ptr;
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const;
+    virtual vec3 random(const vec3 &o, sampler &rng) const;
+    virtual void complete(const ray& r, hit_record& rec) const;
+    float visible_area(const vec3 &o, float *face_area) const;
+    vec3 pmin, pmax;  // p0 is the bottom back front vertex, p1 is the top front right vertex
+    material *mp;
 };
 
-// constructor. p0 is the bottom back front vertex, p1 is the top front right vertex.
-box::box(const vec3& p0, const vec3& p1, material *ptr) {
-    pmin = p0;
-    pmax = p1;
-    hitable **list = new hitable*[6];
-    list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
-    list[1] = new flip_normals(new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
-    list[2] = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
-    list[3] = new flip_normals(new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
-    list[4] = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
-    list[5] = new flip_normals(new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
-    list_ptr = new hitable_list(list,6);
+// slab test of the box from pmin to pmax against a ray from o along d. A ray that starts inside the box hits the face
+// it leaves through. Returns whether a face is hit between t_min and t_max, its distance in t and its number in face
+// Written without branches, so the lane loop of box::hit_packet that calls it is vectorized
+inline int box_slab(const vec3 &pmin, const vec3 &pmax, const float *o, const float *d, float t_min, float t_max,
+                    float &t, int &face) {
+    float t_enter = -MAXFLOAT;
+    float t_exit = MAXFLOAT;
+    int enter_face = 0;
+    int exit_face = 0;
+    for (int a = 0; a < 3; a++) {
+        // the same division as the plane test of a rect, so the hit points agree with an axis aligned rectangle
+        float low = (pmin[a] - o[a]) / d[a];
+        float high = (pmax[a] - o[a]) / d[a];
+        float n = d[a] < 0 ? high : low;
+        float f = d[a] < 0 ? low : high;
+        enter_face = n > t_enter ? 2 * a + (d[a] < 0) : enter_face;
+        t_enter = n > t_enter ? n : t_enter;
+        exit_face = f < t_exit ? 2 * a + (d[a] > 0) : exit_face;
+        t_exit = f < t_exit ? f : t_exit;
+    }
+    // bitwise instead of logical operators, so there are no branches
+    int use_enter = (t_enter >= t_min) & (t_enter <= t_max);
+    int use_exit = (t_exit >= t_min) & (t_exit <= t_max);
+    t = use_enter ? t_enter : t_exit;
+    face = use_enter ? enter_face : exit_face;
+    return (t_enter <= t_exit) & (use_enter | use_exit);
 }
 
-// compute if a ray hits the box
+// compute if a ray hits the box. The face that was hit is kept in rec.part
 bool box::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-    return list_ptr->hit(r, t0, t1, rec);
+    float t;
+    int face;
+    if (!box_slab(pmin, pmax, r.A.e, r.B.e, t0, t1, t, face))
+        return false;
+    rec.t = t;
+    rec.object = this;
+    rec.part = face;
+    return true;
+}
+
+// Compute which rays of a packet hit the box. The slab tests of all lanes run in one loop, the records are only set
+// for the lanes that hit
+int box::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    float t[packet_size];
+    int face[packet_size];
+    int hit[packet_size];
+    for (int l = 0; l < packet_size; l++) {
+        float o[3] = {p.origin[0][l], p.origin[1][l], p.origin[2][l]};
+        float d[3] = {p.direction[0][l], p.direction[1][l], p.direction[2][l]};
+        hit[l] = box_slab(pmin, pmax, o, d, t_min, h.t[l], t[l], face[l]);
+    }
+    int result = packet_mask(hit, mask);
+    for (int l = 0; l < packet_size; l++) {
+        if (!(result & (1 << l)))
+            continue;
+        h.rec[l].t = t[l];
+        h.rec[l].object = this;
+        h.rec[l].part = face[l];
+        h.t[l] = t[l];
+    }
+    return result;
+}
+
+// the point, normal and uv of the closest hit. The normal points out of the box, u and v run along the two other axes
+// of the face in the order x, y, z, as on the rectangle of the face
+void box::complete(const ray& r, hit_record& rec) const {
+    int a = rec.part / 2;
+    int b = a == 0 ? 1 : 0;
+    int c = a == 2 ? 1 : 2;
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = vec3(0, 0, 0);
+    rec.normal[a] = rec.part % 2 ? 1 : -1;
+    rec.u = (rec.p[b] - pmin[b]) / (pmax[b] - pmin[b]);
+    rec.v = (rec.p[c] - pmin[c]) / (pmax[c] - pmin[c]);
+    rec.mat_ptr = mp;
+}
+
+// area of the faces of the box that face the point o. face_area receives the visible area of the -x, +x, -y, +y,
+// -z and +z faces, 0 for the faces turned away from o
+float box::visible_area(const vec3 &o, float *face_area) const {
+    vec3 size = pmax - pmin;
+    float total = 0;
+    for (int a = 0; a < 3; a++) {
+        float area = size[(a + 1) % 3] * size[(a + 2) % 3];
+        face_area[2 * a] = o[a] < pmin[a] ? area : 0;
+        face_area[2 * a + 1] = o[a] > pmax[a] ? area : 0;
+        total += face_area[2 * a] + face_area[2 * a + 1];
+    }
+    return total;
+}
+
+// density of box::random picking direction v from o. Only the faces turned towards o are sampled
+float box::pdf_value(const vec3 &o, const vec3 &v) const {
+    float face_area[6];
+    float area = visible_area(o, face_area);
+    hit_record rec;
+    if (area <= 0 || !this->hit(ray(o, v), 0.001, MAXFLOAT, rec))
+        return 0;
+    float distance_squared = rec.t * rec.t * dot(v, v);
+    float cosine = fabs(v[rec.part / 2] / v.length());
+    return distance_squared / (cosine * area);
+}
+
+// a direction from o to a uniformly random point on the faces of the box turned towards o
+vec3 box::random(const vec3 &o, sampler &rng) const {
+    float face_area[6];
+    float area = visible_area(o, face_area);
+    if (area <= 0)
+        return vec3(1, 0, 0);
+    // pick a face by its area
+    float pick = rng.next() * area;
+    int face = 0;
+    while (face < 5 && (face_area[face] <= 0 || pick >= face_area[face])) {
+        pick -= face_area[face];
+        face++;
+    }
+    // rounding can run past the last visible face
+    while (face_area[face] <= 0)
+        face--;
+    int a = face / 2;
+    vec3 random_point;
+    random_point[a] = face % 2 ? pmax[a] : pmin[a];
+    int b = (a + 1) % 3, c = (a + 2) % 3;
+    random_point[b] = pmin[b] + rng.next() * (pmax[b] - pmin[b]);
+    random_point[c] = pmin[c] + rng.next() * (pmax[c] - pmin[c]);
+    return random_point - o;
 }
 
 #endif //BOX_H
@@ -0,0 +1,184 @@
+// This file contains the bounding volume hierarchy (bvh), a binary tree of bounding boxes over a list of hitables
+// A ray only visits the children whose boxes it passes through, so the cost per ray grows logarithmically
+// with the number of objects instead of linearly like hitable_list
+// The tree is split using the surface area heuristic (SAH)
+// Refer to the documentation for technical and mathematical details
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <algorithm>
+#include "hitable.h"
+#include "arena.h"
+
+// cost of visiting an interior node relative to intersecting a primitive, used by the surface area heuristic
+const float bvh_traversal_cost = 0.125;
+
+// bounding information of a single primitive, used while building a tree
+struct bvh_primitive_info {
+    int index;      // index of the primitive in the input list
+    aabb box;       // bounding box of the primitive
+    vec3 centroid;  // center of the bounding box
+};
+
+// compare two primitives by the centroid along one axis
+struct bvh_centroid_less {
+    bvh_centroid_less(int a) : axis(a) {}
+
+    bool operator()(const bvh_primitive_info &a, const bvh_primitive_info &b) const {
+        return a.centroid[axis] < b.centroid[axis];
+    }
+
+    int axis;
+};
+
+// collect the bounding boxes of a list of hitables
+bool bvh_primitive_infos(hitable **l, int n, float time0, float time1, std::vector<bvh_primitive_info> &prims) {
+    prims.resize(n);
+    for (int i = 0; i < n; i++) {
+        prims[i].index = i;
+        if (!l[i]->bounding_box(time0, time1, prims[i].box)) {
+            std::cerr << "no bounding box in bvh constructor\n";
+            return false;
+        }
+        prims[i].centroid = prims[i].box.centroid();
+    }
+    return true;
+}
+
+// compute the bounding box of prims[begin, end)
+aabb bvh_range_box(const std::vector<bvh_primitive_info> &prims, int begin, int end) {
+    aabb box = prims[begin].box;
+    for (int i = begin + 1; i < end; i++)
+        box = surrounding_box(box, prims[i].box);
+    return box;
+}
+
+// find the split of prims[begin, end) with the lowest surface area heuristic cost
+// on return prims[begin, mid) and prims[mid, end) are the two children, sorted along the chosen axis
+// the returned cost is in units of primitive intersections, so it can be compared against (end - begin) for a leaf
+// If all centroids coincide, every split costs the same and the first one would peel off a single primitive, a
+// chain as deep as the range is long. The range is split in the middle instead and FLT_MAX is returned
+float bvh_sah_split(std::vector<bvh_primitive_info> &prims, int begin, int end, int &mid) {
+    int n = end - begin;
+    mid = begin + n / 2;
+    bool coincide = true;
+    for (int i = begin + 1; i < end && coincide; i++)
+        coincide = prims[i].centroid[0] == prims[begin].centroid[0] &&
+                   prims[i].centroid[1] == prims[begin].centroid[1] &&
+                   prims[i].centroid[2] == prims[begin].centroid[2];
+    if (coincide)
+        return FLT_MAX;
+    float parent_area = bvh_range_box(prims, begin, end).area();
+    if (parent_area <= 0)
+        parent_area = 1;
+    std::vector<float> right_area(n);
+    float best_cost = FLT_MAX;
+    int best_axis = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        std::sort(prims.begin() + begin, prims.begin() + end, bvh_centroid_less(axis));
+        // sweep from the right to get the area of every suffix
+        aabb box = prims[end - 1].box;
+        for (int i = n - 1; i > 0; i--) {
+            box = surrounding_box(box, prims[begin + i].box);
+            right_area[i] = box.area();
+        }
+        // sweep from the left and evaluate every split position
+        box = prims[begin].box;
+        for (int i = 1; i < n; i++) {
+            float cost = bvh_traversal_cost + (box.area() * i + right_area[i] * (n - i)) / parent_area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                mid = begin + i;
+            }
+            box = surrounding_box(box, prims[begin + i].box);
+        }
+    }
+    if (best_axis != 2)
+        std::sort(prims.begin() + begin, prims.begin() + end, bvh_centroid_less(best_axis));
+    return best_cost;
+}
+
+// a node of the bvh. Leaves point straight at the primitives, so a node with a single primitive has left == right
+class bvh_node : public hitable {
+public:
+    bvh_node() {}
+
+    // constructor. Builds the whole tree over the n hitables in l, its nodes are made in storage. Every hitable needs a
+    // bounding box, build_accel() keeps the others out of the tree. Without one, or without hitables, the tree is empty
+    bvh_node(hitable **l, int n, float time0, float time1, arena &storage);
+
+    // build the subtree over prims[begin, end)
+    bvh_node(hitable **l, std::vector<bvh_primitive_info> &prims, int begin, int end, arena &storage);
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
+
+    virtual bool bounding_box(float t0, float t1, aabb &b) const {
+        b = box;
+        return left != NULL;
+    }
+
+    hitable *left;          // NULL in an empty tree
+    hitable *right;
+    aabb box;
+};
+
+bvh_node::bvh_node(hitable **l, int n, float time0, float time1, arena &storage) {
+    std::vector<bvh_primitive_info> prims;
+    if (n < 1 || !bvh_primitive_infos(l, n, time0, time1, prims)) {
+        // an inverted box, no ray passes through it, so the missing children are never reached
+        left = right = NULL;
+        box = aabb(vec3(FLT_MAX, FLT_MAX, FLT_MAX), vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+        return;
+    }
+    *this = bvh_node(l, prims, 0, n, storage);
+}
+
+// build the subtree over prims[begin, end). The nodes are made depth first, so a node lies next to its left child
+bvh_node::bvh_node(hitable **l, std::vector<bvh_primitive_info> &prims, int begin, int end, arena &storage) {
+    int n = end - begin;
+    box = bvh_range_box(prims, begin, end);
+    if (n == 1) {
+        left = right = l[prims[begin].index];
+    } else if (n == 2) {
+        left = l[prims[begin].index];
+        right = l[prims[begin + 1].index];
+    } else {
+        int mid;
+        bvh_sah_split(prims, begin, end, mid);
+        left = mid - begin == 1 ? l[prims[begin].index] : storage.make<bvh_node>(l, prims, begin, mid, storage);
+        right = end - mid == 1 ? l[prims[mid].index] : storage.make<bvh_node>(l, prims, mid, end, storage);
+    }
+}
+
+// compute whether the ray hits anything in the subtree
+bool bvh_node::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
+    if (!box.hit(r, t_min, t_max))
+        return false;
+    bool hit_left = left->hit(r, t_min, t_max, rec);
+    if (right == left)
+        return hit_left;
+    // the right child only has to beat the closest hit found so far
+    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+    return hit_left || hit_right;
+}
+
+// compute which rays of the packet hit anything in the tree. Only the lanes that hit the box go on to the children
+int bvh_node::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    vec3 lo = box.min();
+    vec3 hi = box.max();
+    float t_near[packet_size];
+    mask = packet_box_hit(lo.e, hi.e, p, mask, t_min, h.t, t_near);
+    if (mask == 0)
+        return 0;
+    int result = left->hit_packet(p, mask, t_min, h);
+    if (right != left)
+        result |= right->hit_packet(p, mask, t_min, h);
+    return result;
+}
+
+#endif //BVH_H
@@ -0,0 +1,506 @@
+// This file contains the builders of the flattened binary bvh that linear_bvh traverses and wide_bvh collapses
+// Three builders make the same kind of tree:
+//     sweep   the full sweep surface area heuristic of bvh.h, which sorts every range along every axis. Best trees,
+//             slowest build
+//     binned  the surface area heuristic evaluated at the borders of 32 equal bins per axis instead of between every
+//             pair of primitives, so a range is split in linear time. Trees nearly as good as sweep
+//     lbvh    the primitives sorted along a Morton curve through their centroids with a parallel radix sort, and
+//             split where the highest bit of the codes changes. Fastest build, worst trees
+// Large trees are built in parallel: once a range is split, its two halves are built as separate tasks of the thread
+// pool the caller passes in. The tree is built with primitive ranges only and flattened into the depth-first node array afterwards, which
+// also computes the boxes, orders the children and measures the SAH cost of the result
+// Refer to the documentation for technical and mathematical details
+
+#ifndef BVH_BUILD_H
+#define BVH_BUILD_H
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "bvh.h"
+#include "thread_pool.h"
+
+// most primitives a leaf may hold
+const int linear_bvh_max_leaf = 4;
+
+// depth of the traversal stacks. The builders keep every tree shallower than this
+const int linear_bvh_stack_size = 64;
+
+// depth from which ranges are split in the middle instead of by their cost. Every such split halves a range, so the
+// levels below add at most 31 for 2^31 primitives, and no tree gets as deep as linear_bvh_stack_size, however badly
+// the surface area heuristic splits a skewed scene
+const int bvh_median_depth = linear_bvh_stack_size - 32;
+
+// a node of the flattened tree
+struct linear_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    int offset;             // leaf: index of the first primitive. interior: index of the second child
+    unsigned short count;   // number of primitives in a leaf, 0 for interior nodes
+    unsigned char axis;     // split axis of an interior node
+    unsigned char pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+// store a box in a node
+inline void linear_bvh_set_bounds(linear_bvh_node &node, const aabb &box) {
+    for (int a = 0; a < 3; a++) {
+        node.bounds_min[a] = box.min()[a];
+        node.bounds_max[a] = box.max()[a];
+    }
+}
+
+// read the box of a node back
+inline aabb linear_bvh_bounds(const linear_bvh_node &node) {
+    return aabb(vec3(node.bounds_min[0], node.bounds_min[1], node.bounds_min[2]),
+                vec3(node.bounds_max[0], node.bounds_max[1], node.bounds_max[2]));
+}
+
+// the available builders
+enum bvh_builder {
+    BVH_BUILD_SWEEP,
+    BVH_BUILD_BINNED,
+    BVH_BUILD_LBVH
+};
+
+const bvh_builder default_bvh_builder = BVH_BUILD_BINNED;
+
+// bins per axis of the binned builder
+const int bvh_bin_count = 32;
+
+// trees over fewer primitives are built on the calling thread, a thread pool costs more than it saves
+const int bvh_parallel_primitives = 65536;
+
+// ranges with fewer primitives are built by the task that split them off instead of a task of their own
+const int bvh_task_primitives = 4096;
+
+// what a build took and how good its tree is
+struct bvh_build_stats {
+    bvh_build_stats() : builder(default_bvh_builder), primitives(0), nodes(0), seconds(0), sah_cost(0) {}
+
+    bvh_builder builder;
+    int primitives;
+    int nodes;
+    double seconds;     // wall time of the build
+    float sah_cost;     // expected cost of a ray through the tree in primitive intersections, see bvh_traversal_cost
+};
+
+// parse the name of a builder. Returns false for an unknown name
+bool parse_bvh_builder(const char *name, bvh_builder &builder) {
+    if (strcmp(name, "sweep") == 0)
+        builder = BVH_BUILD_SWEEP;
+    else if (strcmp(name, "binned") == 0)
+        builder = BVH_BUILD_BINNED;
+    else if (strcmp(name, "lbvh") == 0)
+        builder = BVH_BUILD_LBVH;
+    else
+        return false;
+    return true;
+}
+
+const char *bvh_builder_name(bvh_builder builder) {
+    const char *names[] = {"sweep", "binned", "lbvh"};
+    return names[builder];
+}
+
+// print how a build went, for the log of a render
+void print_bvh_build_stats(const char *name, const bvh_build_stats &stats) {
+    printf("%s: %s build of %d primitives into %d nodes (%f s), SAH cost %.2f\n", name, bvh_builder_name(stats.builder),
+           stats.primitives, stats.nodes, stats.seconds, stats.sah_cost);
+}
+
+// find the split of prims[begin, end) with the lowest surface area heuristic cost among the borders of equal bins
+// along each axis. On return prims[begin, mid) and prims[mid, end) are the two children. Returns the cost in units of
+// primitive intersections, or FLT_MAX if all centroids coincide and the range cannot be split this way
+float bvh_binned_split(std::vector<bvh_primitive_info> &prims, int begin, int end, int &mid) {
+    float box_min[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, box_max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    float c_min[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, c_max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (int i = begin; i < end; i++) {
+        const bvh_primitive_info &p = prims[i];
+        for (int a = 0; a < 3; a++) {
+            box_min[a] = std::min(box_min[a], p.box.min()[a]);
+            box_max[a] = std::max(box_max[a], p.box.max()[a]);
+            c_min[a] = std::min(c_min[a], p.centroid[a]);
+            c_max[a] = std::max(c_max[a], p.centroid[a]);
+        }
+    }
+    float parent_area = aabb(vec3(box_min[0], box_min[1], box_min[2]), vec3(box_max[0], box_max[1], box_max[2])).area();
+    if (parent_area <= 0)
+        parent_area = 1;
+
+    // bins along all three axes are filled in one pass
+    struct bin {
+        float min[3], max[3];
+        int count;
+    } bins[3][bvh_bin_count];
+    float scale[3];
+    for (int a = 0; a < 3; a++) {
+        scale[a] = c_max[a] > c_min[a] ? bvh_bin_count / (c_max[a] - c_min[a]) : 0;
+        for (int b = 0; b < bvh_bin_count; b++) {
+            for (int k = 0; k < 3; k++) {
+                bins[a][b].min[k] = FLT_MAX;
+                bins[a][b].max[k] = -FLT_MAX;
+            }
+            bins[a][b].count = 0;
+        }
+    }
+    for (int i = begin; i < end; i++) {
+        const bvh_primitive_info &p = prims[i];
+        for (int a = 0; a < 3; a++) {
+            int b = std::min(int((p.centroid[a] - c_min[a]) * scale[a]), bvh_bin_count - 1);
+            bin &target = bins[a][b];
+            for (int k = 0; k < 3; k++) {
+                target.min[k] = std::min(target.min[k], p.box.min()[k]);
+                target.max[k] = std::max(target.max[k], p.box.max()[k]);
+            }
+            target.count++;
+        }
+    }
+
+    float best_cost = FLT_MAX;
+    int best_axis = -1, best_bin = 0;
+    for (int a = 0; a < 3; a++) {
+        if (scale[a] == 0)
+            continue;
+        // sweep from the right to get the area and count behind every border
+        float right_area[bvh_bin_count];
+        int right_count[bvh_bin_count];
+        float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        int count = 0;
+        for (int b = bvh_bin_count - 1; b > 0; b--) {
+            for (int k = 0; k < 3; k++) {
+                lo[k] = std::min(lo[k], bins[a][b].min[k]);
+                hi[k] = std::max(hi[k], bins[a][b].max[k]);
+            }
+            count += bins[a][b].count;
+            right_area[b] = count > 0 ? aabb(vec3(lo[0], lo[1], lo[2]), vec3(hi[0], hi[1], hi[2])).area() : 0;
+            right_count[b] = count;
+        }
+        // sweep from the left and evaluate the border in front of every bin
+        for (int k = 0; k < 3; k++) {
+            lo[k] = FLT_MAX;
+            hi[k] = -FLT_MAX;
+        }
+        count = 0;
+        for (int b = 1; b < bvh_bin_count; b++) {
+            for (int k = 0; k < 3; k++) {
+                lo[k] = std::min(lo[k], bins[a][b - 1].min[k]);
+                hi[k] = std::max(hi[k], bins[a][b - 1].max[k]);
+            }
+            count += bins[a][b - 1].count;
+            if (count == 0 || right_count[b] == 0)
+                continue;
+            float left_area = aabb(vec3(lo[0], lo[1], lo[2]), vec3(hi[0], hi[1], hi[2])).area();
+            float cost = bvh_traversal_cost + (left_area * count + right_area[b] * right_count[b]) / parent_area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = b;
+            }
+        }
+    }
+    if (best_axis < 0)
+        return FLT_MAX;
+    float axis_min = c_min[best_axis], axis_scale = scale[best_axis];
+    bvh_primitive_info *first = &prims[0] + begin;
+    bvh_primitive_info *split = std::partition(first, &prims[0] + end, [=](const bvh_primitive_info &p) {
+        return std::min(int((p.centroid[best_axis] - axis_min) * axis_scale), bvh_bin_count - 1) < best_bin;
+    });
+    mid = begin + int(split - first);
+    return best_cost;
+}
+
+// split prims[begin, end) in the middle along the axis its centroids spread the most, for ranges at
+// bvh_median_depth. Returns mid, prims[begin, mid) and prims[mid, end) are the two children
+int bvh_median_split(std::vector<bvh_primitive_info> &prims, int begin, int end) {
+    aabb bounds(prims[begin].centroid, prims[begin].centroid);
+    for (int i = begin + 1; i < end; i++)
+        bounds = surrounding_box(bounds, aabb(prims[i].centroid, prims[i].centroid));
+    vec3 extent = bounds.max() - bounds.min();
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (extent[a] > extent[axis])
+            axis = a;
+    int mid = begin + (end - begin) / 2;
+    std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end, bvh_centroid_less(axis));
+    return mid;
+}
+
+// spread the lowest 10 bits of x out to every third bit
+inline uint32_t morton_spread(uint32_t x) {
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// the 30 bit Morton code of a point given as three numbers in [0, 1]
+inline uint32_t morton_code(float x, float y, float z) {
+    uint32_t c[3];
+    float v[3] = {x, y, z};
+    for (int a = 0; a < 3; a++)
+        c[a] = uint32_t(std::min(std::max(v[a] * 1024.0f, 0.0f), 1023.0f));
+    return (morton_spread(c[0]) << 2) | (morton_spread(c[1]) << 1) | morton_spread(c[2]);
+}
+
+// builds one tree. The tree is first built as ranges of prims, then flattened into linear_bvh_nodes
+class bvh_tree_builder {
+public:
+    // constructor. Large trees are built on threads, which may be NULL to build every tree on the calling thread
+    bvh_tree_builder(std::vector<bvh_primitive_info> &p, bvh_builder b, thread_pool *threads)
+            : prims(p), builder(b), used(1), threads(threads), pool(NULL) {}
+
+    // build the tree and append it to nodes. prims end up in leaf order
+    void build(std::vector<linear_bvh_node> &nodes, bvh_build_stats &stats);
+
+private:
+    // a node while the tree is built
+    struct range_node {
+        int begin, end;     // the primitives below the node
+        int children[2];    // the two children of an interior node, -1 in a leaf
+        aabb box;
+    };
+
+    int bvh_chunk_count() const { return pool == NULL ? 1 : pool->size() * 4; }
+
+    void parallel_for(int n, const std::function<void(int, int, int)> &body);
+
+    void sort_by_morton_code();
+
+    void split(int index, int depth);
+
+    aabb compute_bounds(int index);
+
+    int flatten(int index, std::vector<linear_bvh_node> &nodes, std::vector<bvh_primitive_info> &ordered,
+                float root_area, float &cost);
+
+    std::vector<bvh_primitive_info> &prims;
+    bvh_builder builder;
+    std::vector<uint32_t> codes;        // the Morton codes of prims, lbvh only
+    std::vector<range_node> ranges;     // the tree, a binary tree over n primitives has at most 2n - 1 nodes
+    std::atomic<int> used;              // nodes of ranges handed out
+    thread_pool *threads;               // the pool large trees are built on, NULL for none
+    thread_pool *pool;                  // the pool of this build, NULL for a build on the calling thread
+};
+
+// run body(chunk, begin, end) over the bvh_chunk_count() chunks of [0, n), in parallel when there is a pool
+void bvh_tree_builder::parallel_for(int n, const std::function<void(int, int, int)> &body) {
+    int chunks = bvh_chunk_count();
+    for (int c = 0; c < chunks; c++) {
+        int begin = int(int64_t(n) * c / chunks), end = int(int64_t(n) * (c + 1) / chunks);
+        if (pool == NULL)
+            body(c, begin, end);
+        else
+            pool->submit([=, &body]() { body(c, begin, end); });
+    }
+    if (pool != NULL)
+        pool->wait();
+}
+
+// compute the Morton codes of the centroids and sort prims and codes by them with a radix sort of three passes of
+// 10 bits. Every pass counts the digits of each chunk in parallel, and then moves each chunk to the places its
+// counts give it in parallel, which keeps the sort stable
+void bvh_tree_builder::sort_by_morton_code() {
+    int n = prims.size();
+    aabb bounds(prims[0].centroid, prims[0].centroid);
+    for (int i = 1; i < n; i++)
+        bounds = surrounding_box(bounds, aabb(prims[i].centroid, prims[i].centroid));
+    vec3 origin = bounds.min(), extent = bounds.max() - bounds.min();
+    vec3 scale(extent[0] > 0 ? 1 / extent[0] : 0, extent[1] > 0 ? 1 / extent[1] : 0,
+               extent[2] > 0 ? 1 / extent[2] : 0);
+    // the code in the upper half and the index of the primitive in the lower half
+    std::vector<uint64_t> keys(n), sorted(n);
+    parallel_for(n, [&](int chunk, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            vec3 c = prims[i].centroid - origin;
+            keys[i] = (uint64_t(morton_code(c[0] * scale[0], c[1] * scale[1], c[2] * scale[2])) << 32) | uint32_t(i);
+        }
+    });
+
+    const int digits = 1 << 10;
+    int chunks = bvh_chunk_count();
+    std::vector<int> counts(size_t(chunks) * digits);
+    for (int shift = 32; shift < 62; shift += 10) {
+        std::fill(counts.begin(), counts.end(), 0);
+        parallel_for(n, [&](int chunk, int begin, int end) {
+            int *count = &counts[size_t(chunk) * digits];
+            for (int i = begin; i < end; i++)
+                count[(keys[i] >> shift) & (digits - 1)]++;
+        });
+        // turn the counts into the first place of every digit in every chunk, digit major
+        int place = 0;
+        for (int d = 0; d < digits; d++) {
+            for (int c = 0; c < chunks; c++) {
+                int count = counts[size_t(c) * digits + d];
+                counts[size_t(c) * digits + d] = place;
+                place += count;
+            }
+        }
+        parallel_for(n, [&](int chunk, int begin, int end) {
+            int *next = &counts[size_t(chunk) * digits];
+            for (int i = begin; i < end; i++)
+                sorted[next[(keys[i] >> shift) & (digits - 1)]++] = keys[i];
+        });
+        keys.swap(sorted);
+    }
+
+    std::vector<bvh_primitive_info> reordered(n);
+    codes.resize(n);
+    parallel_for(n, [&](int chunk, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            reordered[i] = prims[uint32_t(keys[i])];
+            codes[i] = uint32_t(keys[i] >> 32);
+        }
+    });
+    prims.swap(reordered);
+}
+
+// split the range of node index, depth levels below the root, and build its children, as tasks of their own when
+// they are large
+void bvh_tree_builder::split(int index, int depth) {
+    int begin = ranges[index].begin, end = ranges[index].end;
+    int n = end - begin;
+    int mid = begin;
+    bool leaf = n == 1;
+    if (!leaf && depth >= bvh_median_depth) {
+        leaf = n <= linear_bvh_max_leaf;
+        // the Morton codes stay sorted along with prims, so the lbvh takes the middle of its order
+        mid = builder == BVH_BUILD_LBVH ? begin + n / 2 : bvh_median_split(prims, begin, end);
+    } else if (!leaf && builder == BVH_BUILD_SWEEP) {
+        // a leaf is made when the best split is not cheaper than testing every primitive
+        // coinciding centroids come back split in the middle at FLT_MAX
+        leaf = bvh_sah_split(prims, begin, end, mid) >= n && n <= linear_bvh_max_leaf;
+    } else if (!leaf && builder == BVH_BUILD_BINNED) {
+        float cost = bvh_binned_split(prims, begin, end, mid);
+        leaf = cost >= n && n <= linear_bvh_max_leaf;
+        if (!leaf && cost == FLT_MAX)
+            mid = begin + n / 2;
+    } else if (!leaf) {
+        // split at the first code with the highest differing bit set, the codes are sorted
+        uint32_t differ = codes[begin] ^ codes[end - 1];
+        if (differ == 0) {
+            leaf = n <= linear_bvh_max_leaf;
+            mid = begin + n / 2;
+        } else {
+            uint32_t bit = 1u << (31 - __builtin_clz(differ));
+            mid = int(std::partition_point(codes.begin() + begin, codes.begin() + end,
+                                           [=](uint32_t code) { return (code & bit) == 0; }) - codes.begin());
+        }
+    }
+    if (leaf) {
+        ranges[index].children[0] = ranges[index].children[1] = -1;
+        return;
+    }
+    int first = used.fetch_add(2);
+    ranges[index].children[0] = first;
+    ranges[index].children[1] = first + 1;
+    ranges[first].begin = begin;
+    ranges[first].end = mid;
+    ranges[first + 1].begin = mid;
+    ranges[first + 1].end = end;
+    for (int c = 0; c < 2; c++) {
+        int child = first + c;
+        if (pool != NULL && ranges[child].end - ranges[child].begin >= bvh_task_primitives)
+            pool->submit([this, child, depth]() { split(child, depth + 1); });
+        else
+            split(child, depth + 1);
+    }
+}
+
+// the boxes of every node below index, bottom up
+aabb bvh_tree_builder::compute_bounds(int index) {
+    range_node &node = ranges[index];
+    if (node.children[0] < 0)
+        node.box = bvh_range_box(prims, node.begin, node.end);
+    else
+        node.box = surrounding_box(compute_bounds(node.children[0]), compute_bounds(node.children[1]));
+    return node.box;
+}
+
+// append node index and everything below it to nodes depth first, and its primitives to ordered. The SAH cost of
+// the subtree relative to root_area is added to cost. Returns the index of the node in nodes
+int bvh_tree_builder::flatten(int index, std::vector<linear_bvh_node> &nodes, std::vector<bvh_primitive_info> &ordered,
+                              float root_area, float &cost) {
+    const range_node &node = ranges[index];
+    int result = nodes.size();
+    nodes.push_back(linear_bvh_node());
+    linear_bvh_set_bounds(nodes[result], node.box);
+    nodes[result].pad = 0;
+    float area = node.box.area() / root_area;
+    if (node.children[0] < 0) {
+        nodes[result].offset = ordered.size();
+        nodes[result].count = node.end - node.begin;
+        nodes[result].axis = 0;
+        ordered.insert(ordered.end(), prims.begin() + node.begin, prims.begin() + node.end);
+        cost += area * (node.end - node.begin);
+        return result;
+    }
+    cost += area * bvh_traversal_cost;
+    // pick the axis along which the two children are separated the most
+    int left = node.children[0], right = node.children[1];
+    vec3 d = ranges[right].box.centroid() - ranges[left].box.centroid();
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (fabs(d[a]) > fabs(d[axis]))
+            axis = a;
+    // keep the child with the smaller coordinate first so the traversal can order children by direction sign
+    if (d[axis] < 0)
+        std::swap(left, right);
+    nodes[result].count = 0;
+    nodes[result].axis = axis;
+    flatten(left, nodes, ordered, root_area, cost);
+    int second = flatten(right, nodes, ordered, root_area, cost);
+    nodes[result].offset = second;
+    return result;
+}
+
+void bvh_tree_builder::build(std::vector<linear_bvh_node> &nodes, bvh_build_stats &stats) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int n = prims.size();
+    stats.builder = builder;
+    stats.primitives = n;
+    if (n == 0)
+        return;
+    pool = n >= bvh_parallel_primitives ? threads : NULL;
+    if (builder == BVH_BUILD_LBVH)
+        sort_by_morton_code();
+    ranges.resize(2 * size_t(n));
+    ranges[0].begin = 0;
+    ranges[0].end = n;
+    if (pool != NULL) {
+        pool->submit([this]() { split(0, 0); });
+        pool->wait();
+    } else
+        split(0, 0);
+    pool = NULL;
+
+    float root_area = compute_bounds(0).area();
+    if (root_area <= 0)
+        root_area = 1;
+    std::vector<bvh_primitive_info> ordered;
+    ordered.reserve(n);
+    float cost = 0;
+    int first = nodes.size();
+    nodes.reserve(first + used);
+    flatten(0, nodes, ordered, root_area, cost);
+    prims.swap(ordered);
+    stats.nodes = int(nodes.size()) - first;
+    stats.sah_cost = cost;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// build a tree over prims with the given builder and append its nodes to nodes, the root first. On return prims are
+// in leaf order, so prims[i].index is the primitive the leaves mean by i. Large trees are built on threads, if it
+// is not NULL
+void bvh_build(std::vector<bvh_primitive_info> &prims, bvh_builder builder, std::vector<linear_bvh_node> &nodes,
+               bvh_build_stats &stats, thread_pool *threads = NULL) {
+    bvh_tree_builder tree(prims, builder, threads);
+    tree.build(nodes, stats);
+}
+
+#endif //BVH_BUILD_H
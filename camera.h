@@ -6,6 +6,7 @@
 #define CAMERA_H
 
 #include "ray.h"
+#include "sampler.h"
 
 // the camera class
 class camera {
@@ -41,18 +42,18 @@ public :
     }
 
     // emit a ray from the camera
-    ray get_ray(float s, float t) {
-        vec3 rd = len_radius * random_in_unit_disk();
+    ray get_ray(float s, float t, sampler &rng) const {
+        vec3 rd = len_radius * random_in_unit_disk(rng);
         vec3 offset = u * rd.x() + v * rd.y();
-        float time = time0 + drand48() * (time1 - time0);
+        float time = time0 + rng.next() * (time1 - time0);
         return ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, time);
     }
 
     // get a random point for monte-carlo computation.
-    vec3 random_in_unit_disk() {
+    vec3 random_in_unit_disk(sampler &rng) const {
         vec3 p;
         do {
-            p = 2.0 * vec3(drand48(), drand48(), 0) - vec3(1, 1, 0);
+            p = 2.0 * vec3(rng.next(), rng.next(), 0) - vec3(1, 1, 0);
         } while (dot(p, p) >= 1.0);
         return p;
     }
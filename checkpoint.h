@@ -0,0 +1,119 @@
+// This file contains the checkpoints of a render, the running estimates of every pixel of the band of rows a
+// process renders, saved so a killed render can be resumed
+// The image is rendered in passes that each add samples to every pixel that is not done, and the estimates are
+// saved between two passes, when no worker is changing them. Samples are seeded from their pixel and index, and a
+// pass ends every pixel on a batch boundary, so a resumed render adds exactly the samples the uninterrupted one
+// would have added and ends with the same image
+// A checkpoint is written next to its path and renamed over it once it is complete and on disk, so a process killed
+// while writing leaves the previous checkpoint intact
+// Refer to the documentation for technical details
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include "adaptive.h"
+#include "scene.h"
+#include "accel.h"
+
+static_assert(std::is_trivially_copyable<pixel_estimate>::value, "pixel estimates are saved as they are in memory");
+
+const char checkpoint_magic[8] = {'R', 'T', 'C', 'H', 'K', 'P', 'T', '\0'};
+const uint32_t checkpoint_version = 2;
+
+// what a checkpoint belongs to. A checkpoint is only resumed by a render of the same scene, camera, size and band,
+// with the same trees: objects with faces in the same place are told apart by the order the tree tests them in, so
+// another acceleration structure or builder may render another image. The sampling settings may change, so a
+// finished render can be resumed with more samples
+struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t estimate_size;     // sizeof(pixel_estimate)
+    uint64_t scene_hash;        // of the scene file, 0 for the built-in scene
+    int32_t nx, ny;
+    int32_t band_begin, band_rows;
+    int32_t max_depth, rr_depth;
+    int32_t accel, builder;     // accel_type and bvh_builder of the trees
+    float camera[14];           // lookfrom, lookat, vup, vfov, aperture, focus_dist, time0, time1
+};
+
+static_assert(sizeof(checkpoint_header) == 112, "checkpoint_header has no padding, so it can be compared bytewise");
+
+// the header of the checkpoints of the given render, whose trees are of type accel and built with builder
+checkpoint_header make_checkpoint_header(const scene_settings &settings, accel_type accel, bvh_builder builder,
+                                         uint64_t scene_hash, int band_begin, int band_rows) {
+    checkpoint_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = checkpoint_version;
+    header.estimate_size = sizeof(pixel_estimate);
+    header.scene_hash = scene_hash;
+    header.nx = settings.nx;
+    header.ny = settings.ny;
+    header.band_begin = band_begin;
+    header.band_rows = band_rows;
+    header.max_depth = settings.paths.max_depth;
+    header.rr_depth = settings.paths.rr_depth;
+    header.accel = accel;
+    header.builder = builder;
+    const camera_settings &v = settings.view;
+    float camera[14] = {v.lookfrom[0], v.lookfrom[1], v.lookfrom[2], v.lookat[0], v.lookat[1], v.lookat[2],
+                        v.vup[0], v.vup[1], v.vup[2], v.vfov, v.aperture, v.focus_dist, v.time0, v.time1};
+    memcpy(header.camera, camera, sizeof(camera));
+    return header;
+}
+
+// Save the estimates of a band under path. false, after printing why, if it could not be written, in which case
+// the previous checkpoint at path is left as it was
+bool write_checkpoint(const char *path, const checkpoint_header &header, const std::vector<pixel_estimate> &estimates) {
+    std::string temporary = std::string(path) + ".tmp";
+    FILE *f = fopen(temporary.c_str(), "wb");
+    if (f == NULL) {
+        fprintf(stderr, "cannot write checkpoint %s\n", temporary.c_str());
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(&estimates[0], sizeof(pixel_estimate), estimates.size(), f) == estimates.size() &&
+              fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path) != 0) {
+        fprintf(stderr, "cannot write checkpoint %s\n", path);
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Load the estimates of a band saved under path by a render with the expected header. false, after printing why,
+// if there is no such checkpoint
+bool read_checkpoint(const char *path, const checkpoint_header &expected, std::vector<pixel_estimate> &estimates) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "cannot open checkpoint %s\n", path);
+        return false;
+    }
+    checkpoint_header header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1;
+    if (!ok || memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+        header.version != expected.version || header.estimate_size != expected.estimate_size) {
+        fprintf(stderr, "%s: not a checkpoint of this version of the renderer\n", path);
+        ok = false;
+    } else if (memcmp(&header, &expected, sizeof(header)) != 0) {
+        fprintf(stderr, "%s: the checkpoint belongs to another scene, camera, resolution, band, acceleration "
+                        "structure or bvh builder\n", path);
+        ok = false;
+    } else if (fread(&estimates[0], sizeof(pixel_estimate), estimates.size(), f) != estimates.size()) {
+        fprintf(stderr, "%s: the checkpoint is cut short\n", path);
+        ok = false;
+    }
+    fclose(f);
+    return ok;
+}
+
+#endif //CHECKPOINT_H
@@ -0,0 +1,467 @@
+// This file contains the rendering of one image by many machines, a coordinator and any number of workers that talk
+// over TCP
+// The coordinator cuts the image into tiles and leases them to the workers, one tile per request. Every worker opens
+// one connection per thread, renders the tiles it is given and sends back their linear colors and sample counts,
+// which also asks for the next tile. Fast machines ask more often and get more tiles. A tile whose worker hangs up is
+// leased again right away, a tile whose lease runs out is leased again once no tile is left that was never leased.
+// The first result of a tile wins, later ones are dropped. Samples are seeded from their pixel and index, so any
+// worker renders a tile the same way
+// Workers introduce themselves with the header of a checkpoint of the whole image, which names the scene file,
+// camera, resolution, path depths, acceleration structure and bvh builder. The trees matter because faces in the
+// same place are told apart by the order a tree tests them in, and the default acceleration structure depends on
+// AVX2, so a farm of mixed machines would otherwise put tiles of different images together. The coordinator refuses
+// workers rendering anything else, and hands the accepted ones its sampling settings
+// Messages are sent as they are in memory, so all machines have to share the byte order and float format. A machine
+// that does not is refused by the header check
+// Refer to the documentation for technical details
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include "tile.h"
+#include "adaptive.h"
+#include "checkpoint.h"
+#include "image_file.h"
+#include "thread_pool.h"
+
+// the kinds of messages
+enum cluster_message_type {
+    CLUSTER_HELLO,      // worker: the checkpoint_header of its render
+    CLUSTER_WELCOME,    // coordinator: the adaptive_settings to render with
+    CLUSTER_REFUSED,    // coordinator: the worker renders another image
+    CLUSTER_REQUEST,    // worker: lease me a tile
+    CLUSTER_TILE,       // coordinator: render this tile
+    CLUSTER_RESULT,     // worker: a rendered tile, its colors as float triples then its sample counts as int32
+    CLUSTER_DONE        // coordinator: every tile is rendered
+};
+
+// the head of a message, followed by size bytes of payload
+struct cluster_message {
+    uint32_t type;
+    uint32_t size;
+    int32_t index;      // of the tile in TILE and RESULT
+    int32_t x0, y0, x1, y1;
+    int32_t pad;
+};
+
+// bytes of the payload of the result of t
+size_t cluster_result_size(const tile &t) {
+    return size_t(t.width()) * t.height() * (3 * sizeof(float) + sizeof(int32_t));
+}
+
+// send all n bytes. false if the connection is gone
+bool cluster_send_all(int fd, const void *data, size_t n) {
+    const char *p = static_cast<const char *>(data);
+    while (n > 0) {
+        ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        p += sent;
+        n -= size_t(sent);
+    }
+    return true;
+}
+
+// receive exactly n bytes. false if the connection is gone
+bool cluster_receive_all(int fd, void *data, size_t n) {
+    char *p = static_cast<char *>(data);
+    while (n > 0) {
+        ssize_t received = recv(fd, p, n, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        p += received;
+        n -= size_t(received);
+    }
+    return true;
+}
+
+// send a message of the given type about tile index t, with the payload
+bool cluster_send(int fd, cluster_message_type type, int index, const tile &t, const void *payload, size_t size) {
+    cluster_message message;
+    memset(&message, 0, sizeof(message));
+    message.type = type;
+    message.size = uint32_t(size);
+    message.index = index;
+    message.x0 = t.x0;
+    message.y0 = t.y0;
+    message.x1 = t.x1;
+    message.y1 = t.y1;
+    return cluster_send_all(fd, &message, sizeof(message)) && (size == 0 || cluster_send_all(fd, payload, size));
+}
+
+// send a message without a tile
+bool cluster_send(int fd, cluster_message_type type, const void *payload = NULL, size_t size = 0) {
+    tile none = {0, 0, 0, 0};
+    return cluster_send(fd, type, -1, none, payload, size);
+}
+
+// requests and results are small and a worker waits for every answer, so they are sent at once
+void cluster_no_delay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// the coordinator. Leases the tiles of an nx x ny image to the workers that connect and writes their results
+class cluster_coordinator {
+public:
+    // constructor. Accepts workers whose hello is identity and tells them to render with adaptive. Leases run out
+    // after lease_seconds
+    cluster_coordinator(const checkpoint_header &identity, const adaptive_settings &adaptive, int nx, int ny,
+                        int tile_size, double lease_seconds);
+
+    ~cluster_coordinator();
+
+    // listen on port and serve workers until every tile is written to output and its sample counts, a row of nx
+    // per image row from the bottom, to sample_counts. false, after printing why, if it cannot listen
+    bool run(int port, image_file &output, std::vector<int> &sample_counts);
+
+private:
+    // the tiles and their leases
+    enum tile_state {
+        TILE_FREE,
+        TILE_LEASED,
+        TILE_DONE
+    };
+
+    struct connection {
+        int fd;
+        bool welcomed;
+        bool waiting;               // asked for a tile that it did not get yet
+        std::vector<char> inbox;    // received bytes of messages that are not complete yet
+    };
+
+    cluster_coordinator(const cluster_coordinator &);
+
+    cluster_coordinator &operator=(const cluster_coordinator &);
+
+    int lease();
+
+    bool handle(connection &c, const cluster_message &message, const char *payload, image_file &output,
+                std::vector<int> &sample_counts);
+
+    void drop(size_t index);
+
+    checkpoint_header identity;
+    adaptive_settings adaptive;
+    int nx;
+    double lease_seconds;
+    std::vector<tile> tiles;
+    std::vector<int> states;
+    std::vector<int> holders;       // fd of the connection each leased tile is leased to
+    std::vector<std::chrono::steady_clock::time_point> deadlines;
+    size_t first_free;              // no tile before it is free
+    int done;
+    std::vector<connection> connections;
+    int listener;
+};
+
+cluster_coordinator::cluster_coordinator(const checkpoint_header &identity, const adaptive_settings &adaptive,
+                                         int nx, int ny, int tile_size, double lease_seconds)
+        : identity(identity), adaptive(adaptive), nx(nx), lease_seconds(lease_seconds),
+          tiles(make_tiles(0, 0, nx, ny, tile_size)), states(tiles.size(), TILE_FREE), holders(tiles.size(), -1),
+          deadlines(tiles.size()), first_free(0), done(0), listener(-1) {}
+
+cluster_coordinator::~cluster_coordinator() {
+    for (size_t i = 0; i < connections.size(); i++)
+        close(connections[i].fd);
+    if (listener >= 0)
+        close(listener);
+}
+
+// the tile to lease next: the first free one, else the one whose lease ran out first. -1 if there is none
+int cluster_coordinator::lease() {
+    while (first_free < tiles.size() && states[first_free] != TILE_FREE)
+        first_free++;
+    if (first_free < tiles.size())
+        return int(first_free);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int expired = -1;
+    for (size_t i = 0; i < tiles.size(); i++)
+        if (states[i] == TILE_LEASED && deadlines[i] < now && (expired < 0 || deadlines[i] < deadlines[expired]))
+            expired = int(i);
+    return expired;
+}
+
+// close connection index and free the tiles leased to it
+void cluster_coordinator::drop(size_t index) {
+    int fd = connections[index].fd;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        if (states[i] == TILE_LEASED && holders[i] == fd) {
+            states[i] = TILE_FREE;
+            holders[i] = -1;
+            if (i < first_free)
+                first_free = i;
+        }
+    }
+    close(fd);
+    connections.erase(connections.begin() + index);
+}
+
+// act on one message from c. false if c has to be dropped
+bool cluster_coordinator::handle(connection &c, const cluster_message &message, const char *payload,
+                                 image_file &output, std::vector<int> &sample_counts) {
+    if (message.type == CLUSTER_HELLO) {
+        if (message.size != sizeof(checkpoint_header) || memcmp(payload, &identity, sizeof(identity)) != 0) {
+            fprintf(stderr, "refused a worker that renders another scene, camera, resolution, acceleration structure, "
+                            "bvh builder or build\n");
+            cluster_send(c.fd, CLUSTER_REFUSED);
+            return false;
+        }
+        c.welcomed = true;
+        return cluster_send(c.fd, CLUSTER_WELCOME, &adaptive, sizeof(adaptive));
+    }
+    if (!c.welcomed)
+        return false;
+    if (message.type == CLUSTER_REQUEST) {
+        c.waiting = true;
+        return true;
+    }
+    if (message.type != CLUSTER_RESULT || message.index < 0 || size_t(message.index) >= tiles.size())
+        return false;
+    const tile &t = tiles[message.index];
+    if (message.x0 != t.x0 || message.y0 != t.y0 || message.x1 != t.x1 || message.y1 != t.y1 ||
+        message.size != cluster_result_size(t))
+        return false;
+    if (states[message.index] != TILE_DONE) {
+        int pixels = t.width() * t.height();
+        std::vector<vec3> colors(pixels);
+        std::vector<int32_t> samples(pixels);
+        for (int p = 0; p < pixels; p++) {
+            float rgb[3];
+            memcpy(rgb, payload + p * sizeof(rgb), sizeof(rgb));
+            colors[p] = vec3(rgb[0], rgb[1], rgb[2]);
+        }
+        memcpy(&samples[0], payload + pixels * 3 * sizeof(float), pixels * sizeof(int32_t));
+        output.write_tile(t, &colors[0]);
+        for (int j = t.y0; j < t.y1; j++)
+            for (int i = t.x0; i < t.x1; i++)
+                sample_counts[j * nx + i] = samples[(j - t.y0) * t.width() + (i - t.x0)];
+        states[message.index] = TILE_DONE;
+        holders[message.index] = -1;
+        done++;
+    }
+    // a result asks for the next tile
+    c.waiting = true;
+    return true;
+}
+
+bool cluster_coordinator::run(int port, image_file &output, std::vector<int> &sample_counts) {
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(uint16_t(port));
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener, 64) != 0) {
+        fprintf(stderr, "cannot listen on port %d\n", port);
+        return false;
+    }
+    printf("Coordinating %d tiles on port %d\n", int(tiles.size()), port);
+
+    std::vector<char> buffer(1 << 16);
+    while (done < int(tiles.size())) {
+        std::vector<pollfd> polled(connections.size() + 1);
+        polled[0].fd = listener;
+        polled[0].events = POLLIN;
+        for (size_t i = 0; i < connections.size(); i++) {
+            polled[i + 1].fd = connections[i].fd;
+            polled[i + 1].events = POLLIN;
+        }
+        // wake up now and then to lease out tiles whose leases ran out
+        if (poll(&polled[0], polled.size(), 1000) < 0 && errno != EINTR) {
+            fprintf(stderr, "cannot wait for workers\n");
+            return false;
+        }
+        // read from the connections from the back, so dropping one does not move the ones still to be read
+        for (size_t i = connections.size(); i-- > 0;) {
+            if (polled[i + 1].revents == 0)
+                continue;
+            connection &c = connections[i];
+            ssize_t received = recv(c.fd, &buffer[0], buffer.size(), 0);
+            if (received <= 0) {
+                if (received < 0 && errno == EINTR)
+                    continue;
+                drop(i);
+                continue;
+            }
+            c.inbox.insert(c.inbox.end(), buffer.begin(), buffer.begin() + received);
+            size_t used = 0;
+            bool keep = true;
+            while (keep && c.inbox.size() - used >= sizeof(cluster_message)) {
+                cluster_message message;
+                memcpy(&message, &c.inbox[used], sizeof(message));
+                // nothing a worker sends is larger than the result of a tile, anything else is garbage
+                if (message.size > cluster_result_size(tiles[0])) {
+                    keep = false;
+                    break;
+                }
+                if (c.inbox.size() - used < sizeof(message) + message.size)
+                    break;
+                keep = handle(c, message, &c.inbox[used + sizeof(message)], output, sample_counts);
+                used += sizeof(message) + message.size;
+            }
+            if (!keep) {
+                drop(i);
+                continue;
+            }
+            c.inbox.erase(c.inbox.begin(), c.inbox.begin() + used);
+        }
+        if (polled[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0) {
+                cluster_no_delay(fd);
+                connection c;
+                c.fd = fd;
+                c.welcomed = false;
+                c.waiting = false;
+                connections.push_back(c);
+            }
+        }
+        // answer the workers waiting for a tile
+        for (size_t i = connections.size(); i-- > 0;) {
+            if (!connections[i].waiting || done == int(tiles.size()))
+                continue;
+            int t = lease();
+            if (t < 0)
+                break;
+            states[t] = TILE_LEASED;
+            holders[t] = connections[i].fd;
+            deadlines[t] = std::chrono::steady_clock::now() +
+                           std::chrono::microseconds(int64_t(lease_seconds * 1e6));
+            connections[i].waiting = false;
+            if (!cluster_send(connections[i].fd, CLUSTER_TILE, t, tiles[t], NULL, 0))
+                drop(i);
+        }
+        printf("\033[KTile %d/%d, %d connections\r", done, int(tiles.size()), int(connections.size()));
+        fflush(stdout);
+    }
+    // tell every worker, waiting or still rendering a tile that was leased twice, that the image is finished
+    for (size_t i = 0; i < connections.size(); i++)
+        cluster_send(connections[i].fd, CLUSTER_DONE);
+    return true;
+}
+
+// a worker. Renders the tiles a coordinator leases to it with render, which fills the estimates of a tile, on one
+// connection per thread of pool. Before the first tile adaptive is set to the settings of the coordinator.
+// false, after printing why, if the coordinator cannot be reached, refuses the worker or goes away before the end
+bool run_worker(const char *host, int port, const checkpoint_header &identity, adaptive_settings &adaptive,
+                thread_pool &pool, const std::function<void(const tile &, std::vector<pixel_estimate> &)> &render) {
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = NULL;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", host);
+        return false;
+    }
+
+    // connect and introduce the worker. -1, after printing why, if that does not work
+    auto join = [&](adaptive_settings &given) -> int {
+        for (addrinfo *a = addresses; a != NULL; a = a->ai_next) {
+            int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0)
+                continue;
+            if (connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                close(fd);
+                continue;
+            }
+            cluster_no_delay(fd);
+            cluster_message answer;
+            if (!cluster_send(fd, CLUSTER_HELLO, &identity, sizeof(identity)) ||
+                !cluster_receive_all(fd, &answer, sizeof(answer)) || answer.type != CLUSTER_WELCOME ||
+                answer.size != sizeof(given) || !cluster_receive_all(fd, &given, sizeof(given))) {
+                fprintf(stderr, "%s:%d refused this worker, it renders another scene, camera, resolution, "
+                                "acceleration structure, bvh builder or build\n", host, port);
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
+        fprintf(stderr, "cannot connect to %s:%d\n", host, port);
+        return -1;
+    };
+
+    int first = join(adaptive);
+    if (first < 0) {
+        freeaddrinfo(addresses);
+        return false;
+    }
+    printf("Joined %s:%d with %d threads\n", host, port, pool.size());
+    std::atomic<bool> ok(true);
+    std::atomic<int> tiles_done(0);
+    for (int w = 0; w < pool.size(); w++) {
+        pool.submit([&, w]() {
+            adaptive_settings given;
+            int fd = w == 0 ? first : join(given);
+            if (fd < 0) {
+                ok = false;
+                return;
+            }
+            std::vector<pixel_estimate> estimates;
+            std::vector<char> result;
+            bool finished = cluster_send(fd, CLUSTER_REQUEST);
+            while (finished) {
+                cluster_message message;
+                if (!cluster_receive_all(fd, &message, sizeof(message))) {
+                    finished = false;
+                    break;
+                }
+                if (message.type == CLUSTER_DONE)
+                    break;
+                if (message.type != CLUSTER_TILE) {
+                    finished = false;
+                    break;
+                }
+                tile t = {message.x0, message.y0, message.x1, message.y1};
+                int pixels = t.width() * t.height();
+                estimates.assign(pixels, pixel_estimate());
+                render(t, estimates);
+                result.resize(cluster_result_size(t));
+                for (int p = 0; p < pixels; p++) {
+                    vec3 color = estimates[p].color();
+                    float rgb[3] = {color[0], color[1], color[2]};
+                    int32_t samples = estimates[p].samples;
+                    memcpy(&result[p * sizeof(rgb)], rgb, sizeof(rgb));
+                    memcpy(&result[pixels * sizeof(rgb) + p * sizeof(samples)], &samples, sizeof(samples));
+                }
+                finished = cluster_send(fd, CLUSTER_RESULT, message.index, t, &result[0], result.size());
+                printf("\033[KTile %d\r", ++tiles_done);
+                fflush(stdout);
+            }
+            if (!finished) {
+                fprintf(stderr, "lost the connection to %s:%d\n", host, port);
+                ok = false;
+            }
+            close(fd);
+        });
+    }
+    pool.wait();
+    freeaddrinfo(addresses);
+    return ok;
+}
+
+#endif //CLUSTER_H
@@ -1 +0,0 @@
-for i in {4096..0}; do cat "imgRow$i" 2>/dev/null >> img.ppm; done
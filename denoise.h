@@ -0,0 +1,169 @@
+// This file contains the denoiser, an edge-avoiding a-trous wavelet filter over the rendered image
+// The filter is guided by features of the first hit of every pixel: the color of the surface (albedo), its normal
+// and its distance from the camera. These are nearly free of noise after a few samples, unlike the image
+// The color of every pixel is divided by its albedo first, so textures are kept and only the lighting is smoothed,
+// and multiplied by it again at the end. Each pass averages a pixel with 5 x 5 pixels around it, spaced 1, 2, 4, 8
+// and 16 pixels apart in the five passes, so the last pass reaches 64 pixels away at the cost of 25 taps. A
+// neighbor counts less the more its normal, depth and albedo differ, and the more its lighting differs compared to
+// the standard error of the pixel's estimate. Pixels with a small error, e.g. the ones adaptive sampling let run
+// long, are barely changed, and edges between surfaces stay sharp
+// Every pass filters the tiles of the image in parallel
+// Refer to the documentation for technical and mathematical details
+
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include "render.h"
+#include "thread_pool.h"
+
+// samples averaged into the features of a pixel, so they are antialiased like the image
+const int feature_samples = 4;
+
+// passes of the filter, the last one takes pixels 2^(passes - 1) apart
+const int denoise_passes = 5;
+
+// how fast the weight of a neighbor falls with its difference in lighting (in standard errors), normal (power of
+// the cosine), relative depth and albedo
+const float denoise_sigma_luminance = 4;
+const float denoise_normal_power = 64;
+const float denoise_sigma_depth = 0.05f;
+const float denoise_sigma_albedo = 0.1f;
+
+// edge length of the tiles the filter is run on
+const int denoise_tile_size = 64;
+
+// the first hit seen through a pixel
+struct pixel_features {
+    vec3 albedo;    // reflectance() of the material
+    vec3 normal;    // unit surface normal
+    float depth;    // distance from the camera, 0 where no object is hit
+};
+
+// compute the features of the pixels of tile t, from their first samples. features holds the rows of the image from
+// row band_begin on, nx pixels each
+void render_tile_features(const render_context &ctx, const tile &t, int band_begin,
+                          std::vector<pixel_features> &features) {
+    for (int j = t.y0; j < t.y1; j++) {
+        for (int i = t.x0; i < t.x1; i++) {
+            pixel_features &f = features[size_t(j - band_begin) * ctx.nx + i];
+            vec3 albedo(0, 0, 0), normal(0, 0, 0);
+            float depth = 0;
+            int hits = 0;
+            for (int s = 0; s < feature_samples; s++) {
+                sampler rng;
+                ray r = camera_sample(ctx, i, j, s, rng);
+                hit_record rec;
+                if (!closest_hit(ctx.world, r, 0.001, MAXFLOAT, rec))
+                    continue;
+                albedo += rec.mat_ptr->reflectance(rec);
+                normal += rec.normal;
+                depth += rec.t * r.direction().length();
+                hits++;
+            }
+            f.albedo = hits > 0 ? albedo / float(hits) : vec3(0, 0, 0);
+            f.normal = normal.length() > 0 ? unit_vector(normal) : vec3(0, 0, 0);
+            f.depth = hits > 0 ? depth / hits : 0;
+        }
+    }
+}
+
+// the albedo a color is divided by. Black and missing albedos are left out so they do not blow the color up
+inline vec3 denoise_albedo(const pixel_features &f) {
+    vec3 a = f.albedo;
+    for (int c = 0; c < 3; c++)
+        if (a[c] < 0.01f)
+            a[c] = 1;
+    return a;
+}
+
+// one pass of the filter over tile t of the band, with taps step pixels apart, from color and variance to
+// color_out and variance_out
+void denoise_tile(const tile &t, int nx, int rows, int step, const std::vector<pixel_features> &features,
+                  const std::vector<vec3> &color, const std::vector<float> &variance, std::vector<vec3> &color_out,
+                  std::vector<float> &variance_out) {
+    static const float kernel[5] = {1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16};
+    for (int j = t.y0; j < t.y1; j++) {
+        for (int i = t.x0; i < t.x1; i++) {
+            size_t p = size_t(j) * nx + i;
+            const pixel_features &fp = features[p];
+            float lp = luminance(color[p]);
+            vec3 sum(0, 0, 0);
+            float weights = 0, variance_sum = 0;
+            for (int dy = -2; dy <= 2; dy++) {
+                int y = j + dy * step;
+                if (y < 0 || y >= rows)
+                    continue;
+                for (int dx = -2; dx <= 2; dx++) {
+                    int x = i + dx * step;
+                    if (x < 0 || x >= nx)
+                        continue;
+                    size_t q = size_t(y) * nx + x;
+                    const pixel_features &fq = features[q];
+                    float w = kernel[dx + 2] * kernel[dy + 2];
+                    if (q != p) {
+                        // what is seen through one pixel and not the other is a different surface
+                        if ((fp.depth > 0) != (fq.depth > 0))
+                            continue;
+                        float cosine = dot(fp.normal, fq.normal);
+                        float normal_weight = cosine > 0 ? pow(cosine, denoise_normal_power) : 0;
+                        if (fp.depth <= 0)
+                            normal_weight = 1;
+                        float depth_difference = fp.depth > 0 ? fabs(fp.depth - fq.depth) /
+                                                                (denoise_sigma_depth * step * fp.depth) : 0;
+                        float albedo_difference = (fp.albedo - fq.albedo).length() / denoise_sigma_albedo;
+                        // compared to the standard error of the difference of the two estimates. A pixel whose few
+                        // samples all missed the bright paths underestimates its own error, its neighbors do not
+                        float error = sqrt(variance[p] + variance[q]);
+                        float luminance_difference = fabs(lp - luminance(color[q])) /
+                                                     (denoise_sigma_luminance * error + 1e-6f);
+                        w *= normal_weight * exp(-depth_difference - albedo_difference - luminance_difference);
+                    }
+                    sum += w * color[q];
+                    weights += w;
+                    variance_sum += w * w * variance[q];
+                }
+            }
+            // the pixel itself always has a weight
+            color_out[p] = sum / weights;
+            variance_out[p] = variance_sum / (weights * weights);
+        }
+    }
+}
+
+// denoise the rows of the image from row band_begin on, rows of them with nx pixels each. estimates and features
+// hold the pixels row by row, the denoised colors are stored in colors
+void denoise(thread_pool &pool, int nx, int rows, const std::vector<pixel_estimate> &estimates,
+             const std::vector<pixel_features> &features, std::vector<vec3> &colors) {
+    size_t pixels = size_t(nx) * rows;
+    std::vector<vec3> color(pixels), color_out(pixels);
+    std::vector<float> variance(pixels), variance_out(pixels);
+    for (size_t p = 0; p < pixels; p++) {
+        vec3 albedo = denoise_albedo(features[p]);
+        color[p] = estimates[p].color() / albedo;
+        // the variance of the mean luminance, of the color divided by the albedo
+        const pixel_estimate &e = estimates[p];
+        float a = luminance(albedo);
+        variance[p] = e.samples > 1 ? float(e.m2 / (e.samples - 1) / e.samples) / (a * a) : 0;
+    }
+    std::vector<tile> tiles = make_tiles(0, 0, nx, rows, denoise_tile_size);
+    for (int pass = 0; pass < denoise_passes; pass++) {
+        int step = 1 << pass;
+        for (size_t t = 0; t < tiles.size(); t++) {
+            tile current = tiles[t];
+            pool.submit([&, current, step]() {
+                denoise_tile(current, nx, rows, step, features, color, variance, color_out, variance_out);
+            });
+        }
+        pool.wait();
+        color.swap(color_out);
+        variance.swap(variance_out);
+    }
+    colors.resize(pixels);
+    for (size_t p = 0; p < pixels; p++)
+        colors[p] = color[p] * denoise_albedo(features[p]);
+}
+
+#endif //DENOISE_H
@@ -8,6 +8,8 @@
 
 #include "ray.h"
 #include "aabb.h"
+#include "sampler.h"
+#include "packet.h"
 
 class material;
 
@@ -19,7 +21,16 @@ void get_sphere_uv(const vec3 &p, float &u, float &v) {
     v = (theta + M_PI / 2) / M_PI;
 }
 
+class hitable;
+
+// how many wrappers around each other a record can put off completing, see hit_record
+const int hit_record_wrappers = 4;
+
 // the record of what objects a ray has hit
+// While the closest hit is searched for, hit() only sets t, object and part. Every other field is filled in by
+// object->complete() once the closest hit is known, see closest_hit()
+// A wrapper, see hitable_wrapper, sets object to itself and keeps the object inside it that was hit in inner[level],
+// level being the number of wrappers around it. Outside of hit() and complete() level is 0
 struct hit_record {
     float t;
     float u;
@@ -27,56 +38,204 @@ struct hit_record {
     vec3 p;
     vec3 normal;
     material *mat_ptr;
+    const hitable *object;  // the object that completes the record
+    int part;               // which part of the object was hit, e.g. the face of a box
+    const hitable *inner[hit_record_wrappers];
+    int level = 0;
+};
+
+// the closest hits of the rays of a packet
+struct packet_hits {
+    float t[packet_size];   // distance of the closest hit so far, the t_max of every lane
+    hit_record rec[packet_size];
 };
 
 class hitable {
 public:
     virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const = 0;
 
+    // hit() for the lanes of a packet in mask. A lane whose ray hits closer than h.t gets its record replaced
+    // Returns the lanes that were replaced. Without a packet version the rays are traced one at a time
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
+
     virtual bool bounding_box(float t0, float t1, aabb &box) const = 0;
+
+    // fill in p, normal, u, v and mat_ptr of the hit rec of r that hit() found. Objects whose hit() fills in the
+    // whole record leave it as it is
+    virtual void complete(const ray &r, hit_record &rec) const {}
+
+    // probability density, per unit solid angle, of random() picking the direction v from the point o
+    // only emitters need this, so they can be sampled directly
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const { return 0; }
+
+    // a random direction from the point o towards the object
+    virtual vec3 random(const vec3 &o, sampler &rng) const { return vec3(1, 0, 0); }
+};
+
+// the closest hit of r in world, with the whole record filled in
+inline bool closest_hit(const hitable *world, const ray &r, float t_min, float t_max, hit_record &rec) {
+    if (!world->hit(r, t_min, t_max, rec))
+        return false;
+    rec.object->complete(r, rec);
+    return true;
+}
+
+// fill in the records of the lanes in hits of a packet, after hit_packet() found them
+inline void complete_packet(const ray_packet &p, int hits, packet_hits &h) {
+    for (int l = 0; l < packet_size; l++)
+        if (hits & (1 << l))
+            h.rec[l].object->complete(p.get(l), h.rec[l]);
+}
+
+int hitable::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    int result = 0;
+    for (int l = 0; l < packet_size; l++) {
+        if ((mask & (1 << l)) && hit(p.get(l), t_min, h.t[l], h.rec[l])) {
+            h.t[l] = h.rec[l].t;
+            result |= 1 << l;
+        }
+    }
+    return result;
+}
+
+
+// an object wrapped around another one, ptr, which it moves or turns inside out. Rays are moved into the space of
+// ptr and its hits back out of it
+// hit() only keeps the object inside ptr that was hit, see hit_record. complete() completes the record in the space
+// of ptr and moves it out, so only the closest hit is ever moved
+class hitable_wrapper : public hitable {
+public:
+    hitable_wrapper(hitable *p) : ptr(p) {}
+
+    virtual void complete(const ray &r, hit_record &rec) const;
+
+    virtual bool bounding_box(float t0, float t1, aabb &box) const { return ptr->bounding_box(t0, t1, box); }
+
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const { return ptr->pdf_value(o, v); }
+
+    virtual vec3 random(const vec3 &o, sampler &rng) const { return ptr->random(o, rng); }
+
+    // r moved into the space of ptr
+    virtual ray child_ray(const ray &r) const = 0;
+
+    // move a record completed in the space of ptr out of it
+    virtual void record_to_parent(hit_record &rec) const = 0;
+
+    hitable *ptr;
+
+protected:
+    // hit() of ptr with the ray moved into its space
+    bool hit_child(const ray &child_r, float t_min, float t_max, hit_record &rec) const;
+
+    // hit_packet() of ptr with the packet moved into its space
+    int hit_packet_child(const ray_packet &child_p, int mask, float t_min, packet_hits &h) const;
+
+private:
+    // complete the hit of child_r in the space of ptr and move it out. For records wrapped deeper than they can keep
+    void complete_now(const ray &child_r, hit_record &rec) const {
+        rec.object->complete(child_r, rec);
+        record_to_parent(rec);
+        rec.object = this;
+    }
 };
 
+// the object inside ptr is kept in inner[level] and completed by complete(). Deeper than a record can keep, the
+// record is completed right away
+bool hitable_wrapper::hit_child(const ray &child_r, float t_min, float t_max, hit_record &rec) const {
+    int level = rec.level;
+    rec.level = level + 1;
+    bool hit = ptr->hit(child_r, t_min, t_max, rec);
+    rec.level = level;
+    if (!hit)
+        return false;
+    if (level < hit_record_wrappers) {
+        rec.inner[level] = rec.object;
+        rec.object = this;
+    } else
+        complete_now(child_r, rec);
+    return true;
+}
+
+// the same as hit_child() for every lane
+int hitable_wrapper::hit_packet_child(const ray_packet &child_p, int mask, float t_min, packet_hits &h) const {
+    for (int l = 0; l < packet_size; l++)
+        h.rec[l].level++;
+    int result = ptr->hit_packet(child_p, mask, t_min, h);
+    for (int l = 0; l < packet_size; l++) {
+        hit_record &rec = h.rec[l];
+        rec.level--;
+        if (!(result & (1 << l)))
+            continue;
+        if (rec.level < hit_record_wrappers) {
+            rec.inner[rec.level] = rec.object;
+            rec.object = this;
+        } else
+            complete_now(child_p.get(l), rec);
+    }
+    return result;
+}
+
+// complete the record in the space of ptr, by the object hit() kept, and move it out
+void hitable_wrapper::complete(const ray &r, hit_record &rec) const {
+    int level = rec.level;
+    // hit() completed it already
+    if (level >= hit_record_wrappers)
+        return;
+    rec.level = level + 1;
+    rec.inner[level]->complete(child_ray(r), rec);
+    rec.level = level;
+    record_to_parent(rec);
+}
+
 // flip the normal vector of an object. Used to flip the direction of an object
-class flip_normals : public hitable {
+class flip_normals : public hitable_wrapper {
 public:
-    flip_normals(hitable *p) : ptr(p) {}
+    flip_normals(hitable *p) : hitable_wrapper(p) {}
 
     virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
-        if (ptr->hit(r, t_min, t_max, rec)) {
-            rec.normal = -rec.normal;
-            return true;
-        } else
-            return false;
+        return hit_child(r, t_min, t_max, rec);
     }
 
-    virtual bool bounding_box(float t0, float t1, aabb &box) const {
-        return ptr->bounding_box(t0, t1, box);
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+        return hit_packet_child(p, mask, t_min, h);
     }
 
-    hitable *ptr;
+    virtual ray child_ray(const ray &r) const { return r; }
+
+    virtual void record_to_parent(hit_record &rec) const { rec.normal = -rec.normal; }
 };
 
 // translate the location of a hitable
-class translate : public hitable {
+class translate : public hitable_wrapper {
 public:
-    translate(hitable *p, const vec3 &displacement) : ptr(p), offset(displacement) {}
+    translate(hitable *p, const vec3 &displacement) : hitable_wrapper(p), offset(displacement) {}
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
+        return hit_child(translate::child_ray(r), t_min, t_max, rec);
+    }
 
-    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
 
     virtual bool bounding_box(float t0, float t1, aabb &box) const;
 
-    hitable *ptr;
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const { return ptr->pdf_value(o - offset, v); }
+
+    virtual vec3 random(const vec3 &o, sampler &rng) const { return ptr->random(o - offset, rng); }
+
+    virtual ray child_ray(const ray &r) const { return ray(r.origin() - offset, r.direction(), r.time()); }
+
+    virtual void record_to_parent(hit_record &rec) const { rec.p += offset; }
+
     vec3 offset;    // vec3的偏移
 };
 
-// calculate if a ray has hit the translated object
-bool translate::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
-    ray moved_r(r.origin() - offset, r.direction(), r.time());
-    if (ptr->hit(moved_r, t_min, t_max, rec)) {
-        rec.p += offset;
-        return true;
-    } else
-        return false;
+// the packet moved by the same offset
+int translate::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    ray_packet moved = p;
+    for (int a = 0; a < 3; a++)
+        for (int l = 0; l < packet_size; l++)
+            moved.origin[a][l] -= offset[a];
+    return hit_packet_child(moved, mask, t_min, h);
 }
 
 // calculate if the object is within a bounding box
@@ -89,18 +248,50 @@ bool translate::bounding_box(float t0, float t1, aabb &box) const {
 }
 
 // rotate an object around y-axis
-class rotate_y : public hitable {
+class rotate_y : public hitable_wrapper {
 public:
     rotate_y(hitable *p, float angle);
 
-    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
+        return hit_child(rotate_y::child_ray(r), t_min, t_max, rec);
+    }
+
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
 
     virtual bool bounding_box(float t0, float t1, aabb &box) const {
         box = bbox;
         return hasbox;
     }
 
-    hitable *ptr;
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const {
+        return ptr->pdf_value(to_object(o), to_object(v));
+    }
+
+    virtual vec3 random(const vec3 &o, sampler &rng) const {
+        return to_world(ptr->random(to_object(o), rng));
+    }
+
+    virtual ray child_ray(const ray &r) const {
+        return ray(to_object(r.origin()), to_object(r.direction()), r.time());
+    }
+
+    // rotate the point and the normal vector back
+    virtual void record_to_parent(hit_record &rec) const {
+        rec.p = to_world(rec.p);
+        rec.normal = to_world(rec.normal);
+    }
+
+    // rotate a point or direction from world space into the space of the object
+    vec3 to_object(const vec3 &p) const {
+        return vec3(cos_theta * p[0] - sin_theta * p[2], p[1], sin_theta * p[0] + cos_theta * p[2]);
+    }
+
+    // rotate a point or direction from the space of the object back into world space
+    vec3 to_world(const vec3 &p) const {
+        return vec3(cos_theta * p[0] + sin_theta * p[2], p[1], -sin_theta * p[0] + cos_theta * p[2]);
+    }
+
+    float angle;    // in degrees, as given to the constructor
     float sin_theta;
     float cos_theta;
     bool hasbox;
@@ -108,7 +299,7 @@ public:
 };
 
 // constructor. p is the object to rotate. angle is in degrees
-rotate_y::rotate_y(hitable *p, float angle) : ptr(p) {
+rotate_y::rotate_y(hitable *p, float angle) : hitable_wrapper(p), angle(angle) {
     float radians = (M_PI / 180.) * angle;
     sin_theta = sin(radians);
     cos_theta = cos(radians);
@@ -136,29 +327,19 @@ rotate_y::rotate_y(hitable *p, float angle) : ptr(p) {
     }
     bbox = aabb(min, max);
 }
-// calculate if a ray has hit the rotated object
-bool rotate_y::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
-    vec3 origin = r.origin();
-    vec3 direction = r.direction();
-    origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-    origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-    direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-    direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-    ray rotated_r(origin, direction, r.time());
-    if (ptr->hit(rotated_r, t_min, t_max, rec)) {
-        vec3 p = rec.p;
-        vec3 normal = rec.normal;
-        // rotate the normal vector accordingly
-        p[0] = cos_theta * rec.p[0] + sin_theta * rec.p[2];
-        p[2] = -sin_theta * rec.p[0] + cos_theta * rec.p[2];
-        normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
-        normal[2] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
-        rec.p = p;
-        rec.normal = normal;
-        return true;
-    } else
-        return false;
-}
 
+// the packet rotated the same way as in child_ray()
+int rotate_y::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    ray_packet rotated = p;
+    for (int l = 0; l < packet_size; l++) {
+        rotated.origin[0][l] = cos_theta * p.origin[0][l] - sin_theta * p.origin[2][l];
+        rotated.origin[2][l] = sin_theta * p.origin[0][l] + cos_theta * p.origin[2][l];
+        rotated.direction[0][l] = cos_theta * p.direction[0][l] - sin_theta * p.direction[2][l];
+        rotated.direction[2][l] = sin_theta * p.direction[0][l] + cos_theta * p.direction[2][l];
+        rotated.inv_direction[0][l] = 1.0f / rotated.direction[0][l];
+        rotated.inv_direction[2][l] = 1.0f / rotated.direction[2][l];
+    }
+    return hit_packet_child(rotated, mask, t_min, h);
+}
 
 #endif //HITABLE_H
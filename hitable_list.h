@@ -20,8 +20,14 @@ public:
 
     virtual bool hit(const ray &r, float tmin, float tmax, hit_record &rec) const;
 
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
+
     virtual bool bounding_box(float t0, float t1, aabb &box) const;
 
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const;
+
+    virtual vec3 random(const vec3 &o, sampler &rng) const;
+
     hitable **list;
     int list_size;
 };
@@ -29,6 +35,8 @@ public:
 // compute whether the ray hits anything in the hitable list
 bool hitable_list::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
     hit_record temp_rec;
+    // as deep inside wrappers as rec, see hit_record
+    temp_rec.level = rec.level;
     bool hit_anything = false;
     double closest_so_far = t_max;
     for (int i = 0; i < list_size; i++) {
@@ -41,6 +49,14 @@ bool hitable_list::hit(const ray &r, float t_min, float t_max, hit_record &rec)
     return hit_anything;
 }
 
+// compute which rays of the packet hit anything in the hitable list
+int hitable_list::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    int result = 0;
+    for (int i = 0; i < list_size; i++)
+        result |= list[i]->hit_packet(p, mask, t_min, h);
+    return result;
+}
+
 // compute the compound minimal bounding box of all items in the list
 bool hitable_list::bounding_box(float t0, float t1, aabb &box) const {
     if (list_size < 1) return false;
@@ -51,7 +67,7 @@ bool hitable_list::bounding_box(float t0, float t1, aabb &box) const {
     else
         box = temp_box;
     for (int i = 1; i < list_size; i++) {
-        if (list[0]->bounding_box(t0, t1, temp_box)) {
+        if (list[i]->bounding_box(t0, t1, temp_box)) {
             box = surrounding_box(box, temp_box);
         } else
             return false;
@@ -59,4 +75,18 @@ bool hitable_list::bounding_box(float t0, float t1, aabb &box) const {
     return true;
 }
 
+// the density of random() is the average density of the items, as every item is picked equally often
+float hitable_list::pdf_value(const vec3 &o, const vec3 &v) const {
+    float sum = 0;
+    for (int i = 0; i < list_size; i++)
+        sum += list[i]->pdf_value(o, v);
+    return sum / list_size;
+}
+
+// pick one item at random and a direction towards it
+vec3 hitable_list::random(const vec3 &o, sampler &rng) const {
+    int index = int(rng.next() * list_size);
+    return list[index < list_size ? index : list_size - 1]->random(o, rng);
+}
+
 #endif //HITABLE_LIST_H
@@ -0,0 +1,146 @@
+// This file contains the output image, a binary PPM (P6) or PFM file mapped into memory
+// The file is made at its full size before rendering, with the header in front, and every pixel has a fixed place in
+// it. Workers write each finished tile straight to its place in the mapping, so there is no text formatting and no
+// pass over the image at the end. Machines that render different bands of the image can share one file: each of
+// them maps it and writes only its own rows, the others stay as they are
+// PPM holds 8 bit sRGB-like values (gamma 2, as the renderer always wrote them), PFM holds the linear floats
+// Refer to the documentation for technical details
+
+#ifndef IMAGE_FILE_H
+#define IMAGE_FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vec3.h"
+#include "tile.h"
+
+// the formats of the output image
+enum image_format {
+    IMAGE_PPM,  // binary PPM, P6, three bytes per pixel, top row first
+    IMAGE_PFM   // PFM, three floats per pixel, bottom row first
+};
+
+// the format of an image file by the extension of its path: .pfm is PFM, anything else PPM
+image_format image_format_of(const char *path) {
+    size_t length = strlen(path);
+    if (length >= 4 && strcasecmp(path + length - 4, ".pfm") == 0)
+        return IMAGE_PFM;
+    return IMAGE_PPM;
+}
+
+// an image file mapped into memory for writing. Unmapped when destroyed
+class image_file {
+public:
+    image_file() : address(NULL), size(0), pixels(NULL), nx(0), ny(0), format(IMAGE_PPM) {}
+
+    ~image_file() { close(); }
+
+    // make or reuse the file at path for an nx x ny image, write its header and map it. Pixels that are never
+    // written keep what the file held, black in a new file. false, after printing why, if it cannot be done
+    bool open(const char *path, int width, int height, image_format image_format);
+
+    // write the pixels of t, given as linear colors row by row from its lowest row, to their places in the file
+    void write_tile(const tile &t, const vec3 *colors);
+
+    // write everything back to the file and unmap it. false, after printing why, if it could not be written
+    bool close();
+
+private:
+    image_file(const image_file &);
+
+    image_file &operator=(const image_file &);
+
+    void *address;
+    size_t size;
+    unsigned char *pixels;  // the first pixel after the header
+    int nx, ny;
+    image_format format;
+};
+
+bool image_file::open(const char *path, int width, int height, image_format image_format) {
+    close();
+    char header[64];
+    if (image_format == IMAGE_PFM) {
+        // a negative scale marks little endian floats
+        const uint16_t one = 1;
+        bool little_endian = *reinterpret_cast<const unsigned char *>(&one) == 1;
+        snprintf(header, sizeof(header), "PF\n%d %d\n%s\n", width, height, little_endian ? "-1.0" : "1.0");
+    } else
+        snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    size_t header_size = strlen(header);
+    size_t pixel_size = image_format == IMAGE_PFM ? 3 * sizeof(float) : 3;
+    size_t total = header_size + size_t(width) * height * pixel_size;
+
+    int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open image %s\n", path);
+        return false;
+    }
+    // a file of another size was made for another image and starts over
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t(info.st_size) != total && ftruncate(fd, off_t(total)) != 0)) {
+        fprintf(stderr, "cannot resize image %s\n", path);
+        ::close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "cannot map image %s\n", path);
+        return false;
+    }
+    address = mapping;
+    size = total;
+    memcpy(address, header, header_size);
+    pixels = static_cast<unsigned char *>(address) + header_size;
+    nx = width;
+    ny = height;
+    format = image_format;
+    return true;
+}
+
+void image_file::write_tile(const tile &t, const vec3 *colors) {
+    for (int j = t.y0; j < t.y1; j++) {
+        const vec3 *row = colors + size_t(j - t.y0) * t.width();
+        if (format == IMAGE_PFM) {
+            // the header leaves the floats unaligned, so they are copied in bytewise
+            unsigned char *out = pixels + (size_t(j) * nx + t.x0) * 3 * sizeof(float);
+            for (int i = 0; i < t.width(); i++) {
+                float rgb[3] = {row[i][0], row[i][1], row[i][2]};
+                memcpy(out + i * sizeof(rgb), rgb, sizeof(rgb));
+            }
+        } else {
+            unsigned char *out = pixels + (size_t(ny - 1 - j) * nx + t.x0) * 3;
+            for (int i = 0; i < t.width(); i++) {
+                for (int c = 0; c < 3; c++) {
+                    // gamma 2, and values over 1 are clamped
+                    float gamma = sqrt(row[i][c]);
+                    int v = int(255.99 * gamma);
+                    out[3 * i + c] = (unsigned char) (v > 255 ? 255 : v);
+                }
+            }
+        }
+    }
+}
+
+bool image_file::close() {
+    if (address == NULL)
+        return true;
+    bool ok = msync(address, size, MS_SYNC) == 0;
+    if (!ok)
+        fprintf(stderr, "cannot write the image\n");
+    munmap(address, size);
+    address = NULL;
+    pixels = NULL;
+    return ok;
+}
+
+#endif //IMAGE_FILE_H
@@ -0,0 +1,209 @@
+// This file contains instances, objects placed in the scene by an affine transform
+// An instance holds a 4x3 matrix taking the object into the world and its inverse. A ray is moved into the space of
+// the object once, tested against the object, and the hit is moved back. The object itself is only pointed to, so
+// any number of instances can share one object, a whole bvh of geometry included, and it is stored once
+// Chains of translate and rotate_y wrappers are folded into a single instance by fold_transforms()
+
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hitable.h"
+#include "arena.h"
+
+// an affine transform: a 3x3 matrix in the first three columns and a translation in the fourth
+struct transform {
+    // m * (p, 1)
+    vec3 point(const vec3 &p) const {
+        return vec3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+                    m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+                    m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+
+    // m * (v, 0), a direction is not translated
+    vec3 vector(const vec3 &v) const {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    // the transposed 3x3 matrix times n. Called on the inverse transform, it carries a normal along with the points
+    vec3 normal(const vec3 &n) const {
+        return vec3(m[0][0] * n[0] + m[1][0] * n[1] + m[2][0] * n[2],
+                    m[0][1] * n[0] + m[1][1] * n[1] + m[2][1] * n[2],
+                    m[0][2] * n[0] + m[1][2] * n[1] + m[2][2] * n[2]);
+    }
+
+    transform inverse() const;
+
+    float m[3][4];
+};
+
+// the transform that changes nothing
+inline transform identity_transform() {
+    transform t = {{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}};
+    return t;
+}
+
+// move by offset
+inline transform translation(const vec3 &offset) {
+    transform t = identity_transform();
+    for (int r = 0; r < 3; r++)
+        t.m[r][3] = offset[r];
+    return t;
+}
+
+// rotate around the y axis, the same way as rotate_y
+inline transform rotation_y(float sin_theta, float cos_theta) {
+    transform t = {{{cos_theta, 0, sin_theta, 0}, {0, 1, 0, 0}, {-sin_theta, 0, cos_theta, 0}}};
+    return t;
+}
+
+// a after b: a.point(b.point(p)) for every p
+transform operator*(const transform &a, const transform &b) {
+    transform t;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 4; c++) {
+            double sum = c == 3 ? a.m[r][3] : 0;
+            for (int k = 0; k < 3; k++)
+                sum += double(a.m[r][k]) * b.m[k][c];
+            t.m[r][c] = float(sum);
+        }
+    }
+    return t;
+}
+
+// the transform that undoes this one. Computed in double, the matrix must not be singular
+transform transform::inverse() const {
+    double a[3][3];
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            a[r][c] = m[r][c];
+    // the adjugate divided by the determinant
+    double cofactor[3][3];
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            int r0 = (r + 1) % 3, r1 = (r + 2) % 3;
+            int c0 = (c + 1) % 3, c1 = (c + 2) % 3;
+            cofactor[r][c] = a[r0][c0] * a[r1][c1] - a[r0][c1] * a[r1][c0];
+        }
+    }
+    double determinant = a[0][0] * cofactor[0][0] + a[0][1] * cofactor[0][1] + a[0][2] * cofactor[0][2];
+    transform t;
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            t.m[r][c] = float(cofactor[c][r] / determinant);
+    // the translation is undone after the matrix: -inverse * offset
+    for (int r = 0; r < 3; r++) {
+        double sum = 0;
+        for (int c = 0; c < 3; c++)
+            sum -= cofactor[c][r] / determinant * m[c][3];
+        t.m[r][3] = float(sum);
+    }
+    return t;
+}
+
+// an object placed in the world by an affine transform
+class instance : public hitable_wrapper {
+public:
+    instance(hitable *p, const transform &object_to_world);
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
+        return hit_child(instance::child_ray(r), t_min, t_max, rec);
+    }
+
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
+
+    virtual bool bounding_box(float t0, float t1, aabb &box) const {
+        box = bbox;
+        return hasbox;
+    }
+
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const {
+        return ptr->pdf_value(to_object.point(o), to_object.vector(v));
+    }
+
+    virtual vec3 random(const vec3 &o, sampler &rng) const {
+        return to_world.vector(ptr->random(to_object.point(o), rng));
+    }
+
+    // the ray in the space of the object. The direction is not normalized, so t is the same in both spaces
+    virtual ray child_ray(const ray &r) const {
+        return ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+    }
+
+    // move a hit in the space of the object back into the world
+    virtual void record_to_parent(hit_record &rec) const {
+        rec.p = to_world.point(rec.p);
+        rec.normal = unit_vector(to_object.normal(rec.normal));
+    }
+
+    transform to_world;  // from the space of the object into the world
+    transform to_object; // the inverse of to_world
+    bool hasbox;
+    aabb bbox;
+};
+
+// constructor. p is the object, object_to_world places it in the world
+instance::instance(hitable *p, const transform &object_to_world)
+        : hitable_wrapper(p), to_world(object_to_world), to_object(object_to_world.inverse()) {
+    hasbox = ptr->bounding_box(0, 1, bbox);
+    vec3 min(FLT_MAX, FLT_MAX, FLT_MAX);
+    vec3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    // the box around the eight transformed corners of the box of the object
+    for (int corner = 0; corner < 8; corner++) {
+        vec3 p((corner & 1 ? bbox.max() : bbox.min()).x(), (corner & 2 ? bbox.max() : bbox.min()).y(),
+               (corner & 4 ? bbox.max() : bbox.min()).z());
+        vec3 tester = to_world.point(p);
+        for (int c = 0; c < 3; c++) {
+            if (tester[c] > max[c])
+                max[c] = tester[c];
+            if (tester[c] < min[c])
+                min[c] = tester[c];
+        }
+    }
+    bbox = aabb(min, max);
+}
+
+// the packet moved into the space of the object the same way as in child_ray()
+int instance::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    ray_packet moved;
+    const float (*m)[4] = to_object.m;
+    for (int l = 0; l < packet_size; l++) {
+        for (int a = 0; a < 3; a++) {
+            moved.origin[a][l] = m[a][0] * p.origin[0][l] + m[a][1] * p.origin[1][l] + m[a][2] * p.origin[2][l] +
+                                 m[a][3];
+            moved.direction[a][l] = m[a][0] * p.direction[0][l] + m[a][1] * p.direction[1][l] +
+                                    m[a][2] * p.direction[2][l];
+            moved.inv_direction[a][l] = 1.0f / moved.direction[a][l];
+        }
+        moved.time[l] = p.time[l];
+    }
+    return hit_packet_child(moved, mask, t_min, h);
+}
+
+// replace a chain of translate, rotate_y and instance wrappers around an object by one instance with the product of
+// their transforms, so a ray is moved once instead of once per wrapper. Anything else is returned as it is
+// The instance is made in storage
+hitable *fold_transforms(hitable *h, arena &storage) {
+    transform to_world = identity_transform();
+    int wrappers = 0;
+    hitable *object = h;
+    for (;; wrappers++) {
+        if (translate *t = dynamic_cast<translate *>(object)) {
+            to_world = to_world * translation(t->offset);
+            object = t->ptr;
+        } else if (rotate_y *r = dynamic_cast<rotate_y *>(object)) {
+            to_world = to_world * rotation_y(r->sin_theta, r->cos_theta);
+            object = r->ptr;
+        } else if (instance *i = dynamic_cast<instance *>(object)) {
+            to_world = to_world * i->to_world;
+            object = i->ptr;
+        } else
+            break;
+    }
+    if (wrappers == 0 || (wrappers == 1 && dynamic_cast<instance *>(h)))
+        return h;
+    return storage.make<instance>(object, to_world);
+}
+
+#endif //INSTANCE_H
@@ -0,0 +1,97 @@
+// This file contains the path integrator, which computes the color seen along a camera ray
+// The path is followed in a loop that carries the throughput (the product of all attenuations so far) instead of
+// recursing, so the stack use is constant. After a minimum depth, paths whose throughput is low are ended at
+// random (Russian roulette) and the survivors are weighted up, which keeps the estimate unbiased
+// At every hit of a material that is not a perfect mirror or glass, a shadow ray is sent towards a random point on
+// an emitter (next event estimation). Light reaching such a hit is then found by two strategies, the shadow ray and
+// the next bounce, and both are weighted with the power heuristic (multiple importance sampling, *Optimally
+// Combining Sampling Techniques for Monte Carlo Rendering* by Veach and Guibas)
+
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "hitable.h"
+#include "material.h"
+#include "sampler.h"
+
+// how long paths are
+struct integrator_settings {
+    int max_depth;  // bounces after which a path always ends
+    int rr_depth;   // bounces before Russian roulette starts
+};
+
+// highest probability of a path surviving Russian roulette, so even paths through clear glass end eventually
+const float rr_max_survival = 0.95f;
+
+// power heuristic weight of a strategy with density pdf_a against another one with density pdf_b
+inline float power_heuristic(float pdf_a, float pdf_b) {
+    float a = pdf_a * pdf_a;
+    float b = pdf_b * pdf_b;
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+// light arriving at a hit straight from a random point on one of the lights, through a shadow ray
+vec3 direct_light(const ray &r_in, const hit_record &rec, hitable *world, hitable *lights, sampler &rng) {
+    vec3 to_light = lights->random(rec.p, rng);
+    float light_pdf = lights->pdf_value(rec.p, to_light);
+    if (!(light_pdf > 0))
+        return vec3(0, 0, 0);
+    vec3 f = rec.mat_ptr->eval(r_in, rec, to_light);
+    if (f.x() <= 0 && f.y() <= 0 && f.z() <= 0)
+        return vec3(0, 0, 0);
+    // whatever the shadow ray hits first is what is seen, an object in between simply does not emit
+    hit_record light_rec;
+    if (!closest_hit(world, ray(rec.p, to_light, r_in.time()), 0.001, MAXFLOAT, light_rec))
+        return vec3(0, 0, 0);
+    float weight = power_heuristic(light_pdf, rec.mat_ptr->pdf(r_in, rec, to_light));
+    return f * light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p) * (weight / light_pdf);
+}
+
+// calculate the color of a ray
+vec3 color(const ray &r, hitable *world, hitable *lights, const integrator_settings &settings, sampler &rng) {
+    vec3 radiance(0, 0, 0);
+    vec3 throughput(1, 1, 1);
+    ray current = r;
+    // the previous hit, whether lights were sampled there and the density its bounce picked the current ray with
+    vec3 previous_p;
+    bool previous_sampled_lights = false;
+    float previous_pdf = 0;
+    for (int depth = 0;; depth++) {
+        hit_record rec;
+        if (!closest_hit(world, current, 0.001, MAXFLOAT, rec))
+            break;
+        // Calculate the color of the origin of light
+        vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        if (emitted.x() > 0 || emitted.y() > 0 || emitted.z() > 0) {
+            float weight = 1;
+            if (previous_sampled_lights)
+                weight = power_heuristic(previous_pdf, lights->pdf_value(previous_p, current.direction()));
+            radiance += throughput * emitted * weight;
+        }
+        if (depth >= settings.max_depth)
+            break;
+        bool sample_lights = lights != NULL && !rec.mat_ptr->is_delta();
+        if (sample_lights)
+            radiance += throughput * direct_light(current, rec, world, lights, rng);
+        // Light after scattering
+        scatter_record srec;
+        if (!rec.mat_ptr->sample(current, rec, rng, srec))
+            break;
+        throughput *= srec.attenuation;
+        previous_p = rec.p;
+        previous_sampled_lights = sample_lights;
+        previous_pdf = srec.pdf;
+        // Russian roulette: survive with a probability that follows the throughput
+        if (depth + 1 >= settings.rr_depth) {
+            float survival = fmax(throughput.x(), fmax(throughput.y(), throughput.z()));
+            survival = survival < rr_max_survival ? survival : rr_max_survival;
+            if (rng.next() >= survival)
+                break;
+            throughput /= survival;
+        }
+        current = srec.scattered;
+    }
+    return radiance;
+}
+
+#endif //INTEGRATOR_H
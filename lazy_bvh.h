@@ -0,0 +1,236 @@
+// This file contains the lazy bvh, a binary tree that is built while the image is rendered
+// Only the top levels are split when the tree is made, so the first rays start right away. A node below them is
+// split the first time a ray reaches it. Rays never reach most of the nodes a full build would make, which only
+// have to exist once a ray passes through their parent's box
+// All nodes a tree over n primitives can have are allocated when it is made, so the array never moves while workers
+// read it. Every node carries an atomic state: the worker that moves a node from unbuilt to building splits it alone,
+// with the binned surface area heuristic of bvh_build.h, and publishes its children by storing built with release
+// order. Other workers reaching the node meanwhile wait for it instead of splitting it again
+// Refer to the documentation for technical and mathematical details
+
+#ifndef LAZY_BVH_H
+#define LAZY_BVH_H
+
+#include <vector>
+#include <assert.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "linear_bvh.h"
+
+// levels split when the tree is made. Enough subtrees for every worker to build its own ones right away
+const int lazy_bvh_eager_depth = 8;
+
+// a node of the lazy tree. The box and range are set by the split of the parent, the rest by the split of the node
+struct lazy_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    int begin, end;     // the primitives below the node
+    int depth;          // levels below the root
+    int first_child;    // interior: index of the first child, the second follows it. -1 in a leaf
+    int axis;           // split axis of an interior node
+};
+
+// the states of a lazy node
+enum lazy_bvh_state {
+    LAZY_UNBUILT,
+    LAZY_BUILDING,
+    LAZY_BUILT
+};
+
+// the bvh over a list of hitables that splits its nodes when rays first reach them
+class lazy_bvh : public hitable {
+public:
+    // constructor. Splits the top levels of the tree over the n hitables in l. Every hitable needs a bounding box,
+    // build_accel() keeps the others out of the tree
+    lazy_bvh(hitable **l, int n, float time0, float time1);
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+
+    virtual bool bounding_box(float t0, float t1, aabb &box) const {
+        if (nodes.empty())
+            return false;
+        box = aabb(vec3(nodes[0].bounds_min[0], nodes[0].bounds_min[1], nodes[0].bounds_min[2]),
+                   vec3(nodes[0].bounds_max[0], nodes[0].bounds_max[1], nodes[0].bounds_max[2]));
+        return true;
+    }
+
+    // nodes made so far, the children of split nodes included
+    int node_count() const { return used; }
+
+    // bytes of the node, state and primitive arrays
+    size_t memory() const {
+        return nodes.capacity() * (sizeof(lazy_bvh_node) + sizeof(std::atomic<int>)) +
+               prims.capacity() * sizeof(bvh_primitive_info) + list.capacity() * sizeof(hitable *);
+    }
+
+    int eager_nodes;        // nodes made by the split of the top levels
+    double eager_seconds;   // time the split of the top levels took
+
+private:
+    lazy_bvh(const lazy_bvh &);
+
+    lazy_bvh &operator=(const lazy_bvh &);
+
+    void split(int index) const;
+
+    void expand(int index) const;
+
+    void set_bounds(int index, const aabb &box) const;
+
+    // all of them are changed by splits during hit(), each node and range only by the worker that splits it
+    mutable std::vector<lazy_bvh_node> nodes;
+    mutable std::vector<std::atomic<int> > states;
+    mutable std::vector<bvh_primitive_info> prims;
+    mutable std::atomic<int> used;          // nodes handed out
+    std::vector<hitable *> list;            // the primitives, prims[i].index is an index into list
+};
+
+lazy_bvh::lazy_bvh(hitable **l, int n, float time0, float time1)
+        : eager_nodes(0), eager_seconds(0), used(1), list(l, l + n) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (n < 1 || !bvh_primitive_infos(l, n, time0, time1, prims))
+        return;
+    nodes.resize(2 * size_t(n) - 1);
+    std::vector<std::atomic<int> >(nodes.size()).swap(states);
+    nodes[0].begin = 0;
+    nodes[0].end = n;
+    nodes[0].depth = 0;
+    set_bounds(0, bvh_range_box(prims, 0, n));
+    for (size_t i = 0; i < states.size(); i++)
+        states[i].store(LAZY_UNBUILT, std::memory_order_relaxed);
+
+    // split the top levels breadth first
+    std::vector<int> level(1, 0), next;
+    for (int depth = 0; depth < lazy_bvh_eager_depth && !level.empty(); depth++) {
+        next.clear();
+        for (size_t i = 0; i < level.size(); i++) {
+            split(level[i]);
+            states[level[i]].store(LAZY_BUILT, std::memory_order_relaxed);
+            if (nodes[level[i]].first_child >= 0) {
+                next.push_back(nodes[level[i]].first_child);
+                next.push_back(nodes[level[i]].first_child + 1);
+            }
+        }
+        level.swap(next);
+    }
+    eager_nodes = used;
+    eager_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void lazy_bvh::set_bounds(int index, const aabb &box) const {
+    for (int a = 0; a < 3; a++) {
+        nodes[index].bounds_min[a] = box.min()[a];
+        nodes[index].bounds_max[a] = box.max()[a];
+    }
+}
+
+// split node index into two children, or make it a leaf. Only the caller may touch the node and its range meanwhile
+void lazy_bvh::split(int index) const {
+    lazy_bvh_node &node = nodes[index];
+    int n = node.end - node.begin;
+    int mid = node.begin;
+    float cost = 0;
+    if (n > 1 && node.depth >= bvh_median_depth) {
+        // deep nodes are halved, so the tree stays shallower than the traversal stack
+        mid = bvh_median_split(prims, node.begin, node.end);
+        cost = n <= linear_bvh_max_leaf ? n : 0;
+    } else if (n > 1)
+        cost = bvh_binned_split(prims, node.begin, node.end, mid);
+    // a leaf is made when the best split is not cheaper than testing every primitive
+    if (n == 1 || (cost >= n && n <= linear_bvh_max_leaf)) {
+        node.first_child = -1;
+        node.axis = 0;
+        return;
+    }
+    if (cost == FLT_MAX)
+        mid = node.begin + n / 2;
+    aabb left_box = bvh_range_box(prims, node.begin, mid);
+    aabb right_box = bvh_range_box(prims, mid, node.end);
+    // pick the axis along which the two children are separated the most
+    vec3 d = right_box.centroid() - left_box.centroid();
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (fabs(d[a]) > fabs(d[axis]))
+            axis = a;
+    int first = used.fetch_add(2);
+    // keep the child with the smaller coordinate first so the traversal can order children by direction sign
+    int left = d[axis] < 0 ? first + 1 : first;
+    int right = d[axis] < 0 ? first : first + 1;
+    nodes[left].begin = node.begin;
+    nodes[left].end = mid;
+    nodes[left].depth = node.depth + 1;
+    set_bounds(left, left_box);
+    nodes[right].begin = mid;
+    nodes[right].end = node.end;
+    nodes[right].depth = node.depth + 1;
+    set_bounds(right, right_box);
+    node.first_child = first;
+    node.axis = axis;
+}
+
+// make sure node index is split. Either splits it or waits for the worker that does
+void lazy_bvh::expand(int index) const {
+    int expected = LAZY_UNBUILT;
+    if (states[index].compare_exchange_strong(expected, LAZY_BUILDING, std::memory_order_acquire)) {
+        split(index);
+        states[index].store(LAZY_BUILT, std::memory_order_release);
+        return;
+    }
+    while (states[index].load(std::memory_order_acquire) != LAZY_BUILT)
+        std::this_thread::yield();
+}
+
+// compute whether the ray hits anything in the tree, splitting the nodes it reaches on the way
+bool lazy_bvh::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
+    if (nodes.empty())
+        return false;
+    bvh_ray br(r);
+    int stack[linear_bvh_stack_size];
+    int top = 0;
+    int current = 0;
+    bool hit_anything = false;
+    for (;;) {
+        const lazy_bvh_node &node = nodes[current];
+        float near = t_min, far = t_max;
+        for (int a = 0; a < 3; a++) {
+            float t0 = ((br.dir_is_neg[a] ? node.bounds_max[a] : node.bounds_min[a]) - br.origin[a]) * br.inv_dir[a];
+            float t1 = ((br.dir_is_neg[a] ? node.bounds_min[a] : node.bounds_max[a]) - br.origin[a]) * br.inv_dir[a] *
+                       aabb_far_scale;
+            near = t0 > near ? t0 : near;
+            far = t1 < far ? t1 : far;
+        }
+        if (near <= far) {
+            if (states[current].load(std::memory_order_acquire) != LAZY_BUILT)
+                expand(current);
+            if (node.first_child < 0) {
+                for (int i = node.begin; i < node.end; i++) {
+                    if (list[prims[i].index]->hit(r, t_min, t_max, rec)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                }
+                if (top == 0)
+                    break;
+                current = stack[--top];
+            } else if (br.dir_is_neg[node.axis]) {
+                // split() keeps the tree shallower than the stack
+                assert(top < linear_bvh_stack_size);
+                // the ray travels towards smaller coordinates, so the second child is nearer
+                stack[top++] = node.first_child;
+                current = node.first_child + 1;
+            } else {
+                assert(top < linear_bvh_stack_size);
+                stack[top++] = node.first_child + 1;
+                current = node.first_child;
+            }
+        } else {
+            if (top == 0)
+                break;
+            current = stack[--top];
+        }
+    }
+    return hit_anything;
+}
+
+#endif //LAZY_BVH_H
@@ -0,0 +1,207 @@
+// This file contains the flattened (linear) bvh
+// The tree is stored depth-first in one contiguous array of 32 byte nodes instead of a graph of heap allocated
+// bvh_node objects. The first child of an interior node always follows it directly, so a node only has to store
+// the offset of its second child. Traversal walks the array with a small fixed stack and visits the nearer child first
+// Refer to the documentation for technical and mathematical details
+
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include <vector>
+#include <assert.h>
+#include "bvh_build.h"
+
+// per ray data needed by the traversal, computed once per ray instead of once per node
+struct bvh_ray {
+    bvh_ray(const ray &r) {
+        for (int a = 0; a < 3; a++) {
+            origin[a] = r.origin()[a];
+            inv_dir[a] = 1.0f / r.direction()[a];
+            dir_is_neg[a] = inv_dir[a] < 0;
+        }
+    }
+
+    float origin[3];
+    float inv_dir[3];
+    int dir_is_neg[3];
+};
+
+// slab test of a node using the precomputed ray data
+inline bool linear_bvh_node_hit(const linear_bvh_node &node, const bvh_ray &r, float t_min, float t_max) {
+    for (int a = 0; a < 3; a++) {
+        float t0 = ((r.dir_is_neg[a] ? node.bounds_max[a] : node.bounds_min[a]) - r.origin[a]) * r.inv_dir[a];
+        float t1 = ((r.dir_is_neg[a] ? node.bounds_min[a] : node.bounds_max[a]) - r.origin[a]) * r.inv_dir[a] *
+                   aabb_far_scale;
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+    }
+    return t_min <= t_max;
+}
+
+// walk the tree front to back. leaf(first, count, t_max) intersects a leaf's primitives, shrinks t_max on a hit
+// and returns whether anything was hit. Returns whether any leaf reported a hit
+template<class Leaf>
+bool linear_bvh_traverse(const linear_bvh_node *nodes, const ray &r, float t_min, float t_max, Leaf &leaf) {
+    bvh_ray br(r);
+    int stack[linear_bvh_stack_size];
+    int top = 0;
+    int current = 0;
+    bool hit_anything = false;
+    for (;;) {
+        const linear_bvh_node &node = nodes[current];
+        if (linear_bvh_node_hit(node, br, t_min, t_max)) {
+            if (node.count > 0) {
+                if (leaf(node.offset, node.count, t_max))
+                    hit_anything = true;
+                if (top == 0)
+                    break;
+                current = stack[--top];
+            } else if (br.dir_is_neg[node.axis]) {
+                // the builders keep every tree shallower than the stack
+                assert(top < linear_bvh_stack_size);
+                // the ray travels towards smaller coordinates, so the second child is nearer
+                stack[top++] = current + 1;
+                current = node.offset;
+            } else {
+                assert(top < linear_bvh_stack_size);
+                stack[top++] = node.offset;
+                current = current + 1;
+            }
+        } else {
+            if (top == 0)
+                break;
+            current = stack[--top];
+        }
+    }
+    return hit_anything;
+}
+
+// the flattened bvh over a list of hitables
+class linear_bvh : public hitable {
+public:
+    linear_bvh() : node_array(NULL), node_count(0) {}
+
+    // constructor. Builds the tree over the n hitables in l, on threads if it is not NULL. Every hitable needs a
+    // bounding box, build_accel() keeps the others out of the tree. Without one the tree is empty
+    linear_bvh(hitable **l, int n, float time0, float time1, bvh_builder builder = default_bvh_builder,
+               thread_pool *threads = NULL);
+
+    // constructor. Traverses count nodes built before, which stay where they are and must outlive the tree, over the
+    // n hitables in l in leaf order. Used for the trees of a mapped scene cache
+    linear_bvh(const linear_bvh_node *tree, int count, hitable **l, int n)
+            : node_array(tree), node_count(count), primitives(l, l + n) {}
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
+
+    virtual bool bounding_box(float t0, float t1, aabb &box) const {
+        if (node_count == 0)
+            return false;
+        box = linear_bvh_bounds(node_array[0]);
+        return true;
+    }
+
+    // bytes of the node and primitive arrays
+    size_t memory() const {
+        return nodes.capacity() * sizeof(linear_bvh_node) + primitives.capacity() * sizeof(hitable *);
+    }
+
+    std::vector<linear_bvh_node> nodes;     // the nodes built by the tree, empty when they live elsewhere
+    const linear_bvh_node *node_array;      // the nodes traversed: nodes, or those given to the constructor
+    int node_count;
+    std::vector<hitable *> primitives;      // primitives in leaf order
+    bvh_build_stats stats;                  // how the tree was built, all zero for nodes built before
+
+private:
+    linear_bvh(const linear_bvh &);
+
+    linear_bvh &operator=(const linear_bvh &);
+};
+
+linear_bvh::linear_bvh(hitable **l, int n, float time0, float time1, bvh_builder builder, thread_pool *threads)
+        : node_array(NULL), node_count(0) {
+    std::vector<bvh_primitive_info> prims;
+    if (n < 1 || !bvh_primitive_infos(l, n, time0, time1, prims))
+        return;
+    bvh_build(prims, builder, nodes, stats, threads);
+    primitives.resize(n);
+    for (int i = 0; i < n; i++)
+        primitives[i] = l[prims[i].index];
+    node_array = &nodes[0];
+    node_count = int(nodes.size());
+}
+
+// intersects the primitives of a leaf of linear_bvh
+struct linear_bvh_leaf {
+    linear_bvh_leaf(hitable *const *p, const ray &ray_in, float t, hit_record &record)
+            : primitives(p), r(ray_in), t_min(t), rec(record) {}
+
+    bool operator()(int first, int count, float &t_max) {
+        bool hit_anything = false;
+        for (int i = first; i < first + count; i++) {
+            if (primitives[i]->hit(r, t_min, t_max, rec)) {
+                hit_anything = true;
+                t_max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+
+    hitable *const *primitives;
+    const ray &r;
+    float t_min;
+    hit_record &rec;
+};
+
+// compute whether the ray hits anything in the tree
+bool linear_bvh::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
+    if (node_count == 0)
+        return false;
+    linear_bvh_leaf leaf(&primitives[0], r, t_min, rec);
+    return linear_bvh_traverse(node_array, r, t_min, t_max, leaf);
+}
+
+// compute which rays of the packet hit anything in the tree
+// a node is entered with the lanes that hit its parent and left as soon as none of them hits its box. The children
+// are ordered by the direction of the first of those lanes
+int linear_bvh::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    if (node_count == 0)
+        return 0;
+    struct entry {
+        int node;
+        int mask;
+    };
+    entry stack[linear_bvh_stack_size];
+    int top = 0;
+    int current = 0;
+    int result = 0;
+    float t_near[packet_size];
+    for (;;) {
+        const linear_bvh_node &node = node_array[current];
+        mask = packet_box_hit(node.bounds_min, node.bounds_max, p, mask, t_min, h.t, t_near);
+        if (mask != 0 && node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; i++)
+                result |= primitives[i]->hit_packet(p, mask, t_min, h);
+        } else if (mask != 0) {
+            int first = __builtin_ctz(mask);
+            int near = current + 1;
+            int far = node.offset;
+            if (p.direction[node.axis][first] < 0)
+                std::swap(near, far);
+            assert(top < linear_bvh_stack_size);
+            stack[top].node = far;
+            stack[top++].mask = mask;
+            current = near;
+            continue;
+        }
+        if (top == 0)
+            break;
+        top--;
+        current = stack[top].node;
+        mask = stack[top].mask;
+    }
+    return result;
+}
+
+#endif //LINEAR_BVH_H
@@ -8,92 +8,267 @@
 #include "random"
 #include "material.h"
 #include "scene.h"
+#include "scene_file.h"
+#include "scene_cache.h"
 #include "aarect.h"
+#include "accel.h"
 #include <math.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <chrono>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "thread_pool.h"
+#include "tile.h"
+#include "adaptive.h"
+#include "integrator.h"
+#include "render.h"
+#include "wavefront.h"
+#include "image_file.h"
+#include "checkpoint.h"
+#include "cluster.h"
+#include "denoise.h"
 
 #define verbose
 
 
 using namespace std;
 
-vec3 color(const ray &r, hitable *world, int depth) {
-    // calculate the color of a ray
-    hit_record rec;
-    if (world->hit(r, 0.001, MAXFLOAT, rec)) {
-        // Light after scattering
-        ray scattered;
-        // Light attenuation
-        vec3 attenuation;
-        // Calculate the color of the origin of light
-        vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-        if (depth < 50 && rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-            // regression
-            return emitted + attenuation * color(scattered, world, depth + 1);
-        } else {
-            return emitted;
+// Main function. All detail for rendering are implemented in the header.
+// Here are scene configuration as well as camera configuration
+int main(int argc, char **argv) {
+    // edge length of the tiles the workers render
+    const int tileSize = 16;
+    // edge length of the tiles a coordinator leases, larger so workers seldom wait for the network
+    const int clusterTileSize = 64;
+
+    // options start with "--", everything else is positional
+    accel_type accel = default_accel;
+    bvh_builder builder = default_bvh_builder;
+    render_engine engine = ENGINE_PATH;
+    int threads = 0; // one per hardware thread
+    const char *sceneFile = NULL; // the built-in scene without one
+    const char *cacheFile = NULL; // compiled scene file, mapped instead of parsing the scene file
+    const char *outputFile = "img.ppm";
+    const char *checkpointFile = NULL; // no checkpoints without one
+    double checkpointInterval = 300; // seconds between two checkpoints
+    bool resume = false;
+    int coordinatorPort = 0; // not a coordinator without one
+    const char *workerAddress = NULL; // HOST:PORT of the coordinator of a worker
+    double leaseSeconds = 600; // seconds after which a leased tile is leased again
+    bool denoiseImage = false;
+    const char *aovPrefix = NULL; // no feature images without one
+    // options that replace the settings of the scene, -1 where they are not given
+    int sppMin = -1, sppMax = -1, maxDepth = -1, rrDepth = -1, width = -1, height = -1;
+    float maxError = -1;
+    char *positional[2];
+    int positionalCount = 0;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--accel") == 0 && a + 1 < argc) {
+            // acceleration structure: list, bvh, linear, bvh4, bvh8 or lazy
+            if (!parse_accel(argv[++a], accel)) {
+                fprintf(stderr, "unknown acceleration structure %s\n", argv[a]);
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--builder") == 0 && a + 1 < argc) {
+            // how the bvh is built: sweep, binned or lbvh
+            if (!parse_bvh_builder(argv[++a], builder)) {
+                fprintf(stderr, "unknown bvh builder %s\n", argv[a]);
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--engine") == 0 && a + 1 < argc) {
+            // how paths are followed: path or wavefront
+            if (!parse_engine(argv[++a], engine)) {
+                fprintf(stderr, "unknown render engine %s\n", argv[a]);
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            // number of worker threads
+            threads = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--spp-min") == 0 && a + 1 < argc) {
+            // samples per pixel before the error is checked
+            sppMin = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--spp-max") == 0 && a + 1 < argc) {
+            // samples per pixel at most
+            sppMax = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--error") == 0 && a + 1 < argc) {
+            // relative standard error at which a pixel stops
+            maxError = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--max-depth") == 0 && a + 1 < argc) {
+            // bounces after which a path always ends
+            maxDepth = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--rr-depth") == 0 && a + 1 < argc) {
+            // bounces before Russian roulette may end a path
+            rrDepth = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--scene") == 0 && a + 1 < argc) {
+            // scene file to render instead of the built-in scene
+            sceneFile = argv[++a];
+        } else if (strcmp(argv[a], "--cache") == 0 && a + 1 < argc) {
+            // compiled copy of the scene file, written when it is missing or out of date
+            cacheFile = argv[++a];
+        } else if (strcmp(argv[a], "--output") == 0 && a + 1 < argc) {
+            // image to write, binary PPM or PFM by its extension
+            outputFile = argv[++a];
+        } else if (strcmp(argv[a], "--checkpoint") == 0 && a + 1 < argc) {
+            // file the state of the render is saved to between passes
+            checkpointFile = argv[++a];
+        } else if (strcmp(argv[a], "--checkpoint-interval") == 0 && a + 1 < argc) {
+            // seconds between two checkpoints
+            checkpointInterval = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--resume") == 0) {
+            // continue the render saved in the checkpoint
+            resume = true;
+        } else if (strcmp(argv[a], "--coordinator") == 0 && a + 1 < argc) {
+            // lease the tiles of the image to workers connecting to this port
+            coordinatorPort = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--worker") == 0 && a + 1 < argc) {
+            // render tiles leased by the coordinator at HOST:PORT
+            workerAddress = argv[++a];
+        } else if (strcmp(argv[a], "--lease") == 0 && a + 1 < argc) {
+            // seconds a worker may take for a tile before it is leased again
+            leaseSeconds = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--denoise") == 0) {
+            // filter the noise out of the finished image
+            denoiseImage = true;
+        } else if (strcmp(argv[a], "--aovs") == 0 && a + 1 < argc) {
+            // write the albedo, normal and depth of the first hits to PREFIX_albedo.pfm, ...
+            aovPrefix = argv[++a];
+        } else if (strcmp(argv[a], "--resolution") == 0 && a + 2 < argc) {
+            // pixel count (x,y)
+            width = atoi(argv[++a]);
+            height = atoi(argv[++a]);
+        } else if (positionalCount < 2) {
+            positional[positionalCount++] = argv[a];
         }
-    } else {
-        return vec3(0, 0, 0);
     }
-}
-
-
-// convert a NaN result to a usable result
-// refer to documentation for details
-inline vec3 de_nan(const vec3 &c) { //
-    vec3 t = c;
-    if (!(t[0] == t[0]))
-        t[0] = 0;
-    if (!(t[1] == t[1]))
-        t[1] = 0;
-    if (!(t[2] == t[2]))
-        t[2] = 0;
-    return t;
-}
 
-const int processesCount = 8; // how many worker processes to spawn
+    // every object of the scene lives in this arena and is freed with it
+    arena storage;
+    scene_settings settings = default_scene_settings();
+    scene_description world;
+    if (cacheFile != NULL && sceneFile == NULL) {
+        fprintf(stderr, "--cache needs a --scene to compile\n");
+        return 1;
+    }
+    if ((coordinatorPort > 0 || workerAddress != NULL) && checkpointFile != NULL) {
+        fprintf(stderr, "--checkpoint renders a band of its own, not with a coordinator\n");
+        return 1;
+    }
+    if ((coordinatorPort > 0 || workerAddress != NULL) && (denoiseImage || aovPrefix != NULL)) {
+        fprintf(stderr, "--denoise and --aovs need the whole band, not tiles leased by a coordinator\n");
+        return 1;
+    }
+    if (resume && checkpointFile == NULL) {
+        fprintf(stderr, "--resume needs a --checkpoint to resume from\n");
+        return 1;
+    }
+    // the trees of the scene are built on the same threads that render it
+    thread_pool pool(threads);
+    if (sceneFile != NULL) {
+        auto loadStart = chrono::steady_clock::now();
+        uint64_t sourceHash = 0;
+        bool hashed = cacheFile != NULL && scene_source_hash(sceneFile, sourceHash);
+        bool cached = hashed && load_scene_cache(cacheFile, sourceHash, accel, builder, storage, settings, world);
+        if (!cached && !load_scene(sceneFile, storage, accel, builder, &pool, settings, world))
+            return 1;
+        printf("Loaded %s (%f s)\n", cached ? cacheFile : sceneFile,
+               chrono::duration<double>(chrono::steady_clock::now() - loadStart).count());
+        if (hashed && !cached && write_scene_cache(cacheFile, sourceHash, accel, builder, settings, world))
+            printf("Compiled %s into %s\n", sceneFile, cacheFile);
+    } else
+        world = scene(storage, accel, builder, &pool);
+    if (world.build.nodes > 0)
+        print_bvh_build_stats("BVH", world.build);
+    if (const lazy_bvh *tree = dynamic_cast<const lazy_bvh *>(world.world))
+        printf("BVH: lazy, top levels split into %d nodes (%f s)\n", tree->eager_nodes, tree->eager_seconds);
+    print_scene_memory("Scene", storage);
 
-// Create processes so the computation can be spread out to take advantage of multiple CPUs
-int createProcess() {
-    int id = 0;
-    for (int level = log2(processesCount); level > 0; level--) {
-        if (fork() == 0)
-            id += pow(2, level - 1);
+    // the options win over the scene
+    if (sppMin >= 0)
+        settings.adaptive.min_samples = sppMin;
+    if (sppMax >= 0)
+        settings.adaptive.max_samples = sppMax;
+    if (maxError >= 0)
+        settings.adaptive.max_relative_error = maxError;
+    if (maxDepth >= 0)
+        settings.paths.max_depth = maxDepth;
+    if (rrDepth >= 0)
+        settings.paths.rr_depth = rrDepth;
+    if (width > 0 && height > 0) {
+        settings.nx = width;
+        settings.ny = height;
     }
-#ifdef verbose
-    printf("\033[s\033[%dAProcess %d created\033[u", processesCount - id, id);
-#endif
-    return id;
-}
+    adaptive_settings &adaptive = settings.adaptive;
+    if (adaptive.min_samples < 1)
+        adaptive.min_samples = 1;
+    if (adaptive.max_samples < adaptive.min_samples)
+        adaptive.max_samples = adaptive.min_samples;
+    const int nx = settings.nx;
+    const int ny = settings.ny;
+    camera cam = make_camera(settings);
+    render_context context;
+    context.cam = &cam;
+    context.world = world.world;
+    context.lights = world.lights;
+    context.nx = nx;
+    context.ny = ny;
+    context.adaptive = adaptive;
+    context.paths = settings.paths;
 
-// Main function. All detail for rendering are implemented in the header.
-// Here are scene configuration as well as camera configuration
-int main(int argc, char **argv) {
-    // pixel count (x,y)
-    const int nx = 4096;
-    const int ny = 4096;
-    // Sampling Size
-    const int ns = 100000;
-    // Camera View
-    vec3 lookfrom(500, 500, -1300);
-    vec3 lookat(500, 500, 1000);
-    float dist_to_focus = 10.0;
-    float aperture = 0.0;
-    float vfov = 40.0;
-    camera cam(lookfrom, lookat, vec3(0, 1, 0), vfov, float(nx) / float(ny), aperture, dist_to_focus, 0.0, 1.0);
-
-    hitable *world = scene();
+    if (coordinatorPort > 0 || workerAddress != NULL) {
+        // the coordinator and its workers agree on the whole image, and the workers render with its sampling settings
+        uint64_t sceneHash = 0;
+        if (sceneFile != NULL && !scene_source_hash(sceneFile, sceneHash))
+            return 1;
+        checkpoint_header identity = make_checkpoint_header(settings, accel, builder, sceneHash, 0, ny);
+        auto start = chrono::system_clock::now();
+        if (workerAddress != NULL) {
+            char host[256];
+            int port = 0;
+            const char *colon = strrchr(workerAddress, ':');
+            if (colon == NULL || size_t(colon - workerAddress) >= sizeof(host) || (port = atoi(colon + 1)) <= 0) {
+                fprintf(stderr, "--worker needs HOST:PORT, not %s\n", workerAddress);
+                return 1;
+            }
+            memcpy(host, workerAddress, colon - workerAddress);
+            host[colon - workerAddress] = '\0';
+            bool ok = run_worker(host, port, identity, context.adaptive, pool,
+                                 [&](const tile &current, vector<pixel_estimate> &estimates) {
+                                     if (engine == ENGINE_WAVEFRONT)
+                                         render_tile_wavefront(context, current, estimates);
+                                     else
+                                         render_tile_path(context, current, estimates);
+                                 });
+            if (!ok)
+                return 1;
+            printf("\033[KWorker finished (%f s)\n",
+                   chrono::duration<double>(chrono::system_clock::now() - start).count());
+            return 0;
+        }
+        image_file output;
+        if (!output.open(outputFile, nx, ny, image_format_of(outputFile)))
+            return 1;
+        vector<int> sampleCounts(size_t(nx) * ny);
+        cluster_coordinator coordinator(identity, adaptive, nx, ny, clusterTileSize, leaseSeconds);
+        if (!coordinator.run(coordinatorPort, output, sampleCounts) || !output.close())
+            return 1;
+        long long totalSamples = 0;
+        for (size_t p = 0; p < sampleCounts.size(); p++)
+            totalSamples += sampleCounts[p];
+        printf("\033[KCompleted (%f s), %.1f samples per pixel on average\n",
+               chrono::duration<double>(chrono::system_clock::now() - start).count(),
+               double(totalSamples) / sampleCounts.size());
+        return 0;
+    }
 
     random_device rd;
     int distribution_count, distribution_index;
 
-    if (argc >= 3) {
-        sscanf(argv[1], "%d", &distribution_count);
-        sscanf(argv[2], "%d", &distribution_index);
+    if (positionalCount >= 2) {
+        sscanf(positional[0], "%d", &distribution_count);
+        sscanf(positional[1], "%d", &distribution_index);
     } else {
         printf("Distribution count?: ");
         scanf("%d", &distribution_count);
@@ -103,81 +278,157 @@ int main(int argc, char **argv) {
     int distributionSliceBegin = ny / distribution_count * distribution_index;
     int distributionSliceRange = ny / distribution_count;
 
-    ofstream mainFile("img.ppm");
-    mainFile << "P3\n" << nx << " " << ny << "\n255\n";
-    mainFile.close(); // create the main file
-
-    printf("%s", "\033[2J");
-    for (int i = 0; i < processesCount; i++) {
-        printf("%s", "\n");
+    // a checkpoint holds the estimates of the whole band and the denoiser filters them, so they are kept for the whole
+    // band while checkpointing or denoising. Otherwise every tile keeps its own ones while it is rendered
+    vector<pixel_estimate> bandEstimates;
+    if (checkpointFile != NULL || denoiseImage)
+        bandEstimates.resize(size_t(nx) * distributionSliceRange);
+    checkpoint_header checkpointHeader;
+    if (checkpointFile != NULL) {
+        uint64_t sceneHash = 0;
+        if (sceneFile != NULL && !scene_source_hash(sceneFile, sceneHash))
+            return 1;
+        checkpointHeader = make_checkpoint_header(settings, accel, builder, sceneHash, distributionSliceBegin,
+                                                  distributionSliceRange);
+        if (resume) {
+            if (!read_checkpoint(checkpointFile, checkpointHeader, bandEstimates))
+                return 1;
+            printf("Resumed %s\n", checkpointFile);
+        }
     }
 
-    //spawn workers and calculate there respective assignments
-    int workerID = createProcess();
-    int workerBegin = distributionSliceRange / processesCount * (workerID + 1) + distributionSliceBegin;
-    int workerEnd = distributionSliceRange / processesCount * workerID + distributionSliceBegin;
-
-#ifdef verbose // use compiler macro to reduce runtime calculation
-    printf("\033[s\033[%dAWorker %d: row %d-row%d\033[u", processesCount * 2 - workerID + 1, workerID, workerEnd,
-           workerBegin - 1);
-#endif
+    // every band of rows lands in the same file, each machine writes only its own rows
+    image_file output;
+    if (!output.open(outputFile, nx, ny, image_format_of(outputFile)))
+        return 1;
 
-#ifndef verbose
-    printf("Worker %d: row %d-row%d\n", workerID, workerEnd, workerBegin - 1);
-#endif
+    // the band of rows this machine renders is cut into small tiles that the workers take from their deques
+    vector<tile> tiles = make_tiles(0, distributionSliceBegin, nx, distributionSliceBegin + distributionSliceRange,
+                                    tileSize);
+    vector<int> sampleCounts(nx * distributionSliceRange);
+    printf("Rendering rows %d-%d with %d threads\n", distributionSliceBegin,
+           distributionSliceBegin + distributionSliceRange - 1, pool.size());
 
+    // With checkpoints the image is rendered in passes, each of which lets the pixels take samples up to a limit
+    // that doubles from pass to pass. The limits are whole batches, so every pixel takes the samples it would have
+    // taken in one pass. Without checkpoints there is a single pass up to max_samples
+    int passLimit = adaptive.max_samples;
+    if (checkpointFile != NULL)
+        passLimit = min(adaptive.max_samples,
+                        adaptive.batch * ((adaptive.min_samples + adaptive.batch - 1) / adaptive.batch));
     auto start = chrono::system_clock::now();
-    for (int j = workerBegin - 1; j >= workerEnd; j--) {
-
-        char fileName[15];
-        sprintf(fileName, "imgRow%d", j);
-        ofstream OutFile(fileName);
-
-        for (int i = 0; i < nx; i++) {
-            vec3 col(0, 0, 0);
+    auto lastCheckpoint = chrono::steady_clock::now();
+    for (int pass = 1;; pass++) {
+        context.adaptive.max_samples = passLimit;
+        atomic<int> tilesDone(0);
+        for (size_t t = 0; t < tiles.size(); t++) {
+            tile current = tiles[t];
+            pool.submit([&, current, pass]() {
+                vector<pixel_estimate> estimates(current.width() * current.height());
+                if (!bandEstimates.empty())
+                    for (int j = current.y0; j < current.y1; j++)
+                        copy_n(&bandEstimates[size_t(j - distributionSliceBegin) * nx + current.x0], current.width(),
+                               &estimates[(j - current.y0) * current.width()]);
+                if (engine == ENGINE_WAVEFRONT)
+                    render_tile_wavefront(context, current, estimates);
+                else
+                    render_tile_path(context, current, estimates);
+                vector<vec3> colors(estimates.size());
+                for (int j = current.y0; j < current.y1; j++) {
+                    for (int i = current.x0; i < current.x1; i++) {
+                        int index = (j - current.y0) * current.width() + (i - current.x0);
+                        // average the color
+                        colors[index] = estimates[index].color();
+                        sampleCounts[(j - distributionSliceBegin) * nx + i] = estimates[index].samples;
+                        if (!bandEstimates.empty())
+                            bandEstimates[size_t(j - distributionSliceBegin) * nx + i] = estimates[index];
+                    }
+                }
+                output.write_tile(current, &colors[0]);
 #ifdef verbose // use compiler macro to reduce runtime calculation
-            printf("\033[s\033[%dA\033[KWorker %d: %d/%d\033[u", processesCount - workerID, workerID,
-                   (workerBegin - j - 1) * nx + i, (workerBegin - workerEnd) * nx);
-            cout.flush();
+                printf("\033[KPass %d, tile %d/%d\r", pass, ++tilesDone, int(tiles.size()));
+                cout.flush();
 #endif
-            for (int s = 0; s < ns; s++) {
-                float u = float(i + drand48()) / float(nx);
-                float v = float(j + drand48()) / float(ny);
-
-                ray r = cam.get_ray(u, v);
-                vec3 p = r.point_at_parameter(2.0);
-                vec3 temp = color(r, world, 0);
-                temp = de_nan(temp);
-                col += temp;
-            }
+            });
+        }
+        pool.wait();
 
-            // average the color
-            col /= float(ns);
-            col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
+        bool last = passLimit >= adaptive.max_samples;
+        // no worker touches the estimates between two passes
+        if (checkpointFile != NULL &&
+            (last || chrono::duration<double>(chrono::steady_clock::now() - lastCheckpoint).count() >=
+                     checkpointInterval)) {
+            if (!write_checkpoint(checkpointFile, checkpointHeader, bandEstimates))
+                return 1;
+            lastCheckpoint = chrono::steady_clock::now();
+        }
+        if (last)
+            break;
+        passLimit = min(adaptive.max_samples, 2 * passLimit);
+    }
 
-            int ir = int(255.99 * col[0]);
-            int ig = int(255.99 * col[1]);
-            int ib = int(255.99 * col[2]);
-            // r,g,b value can be larger than 255. When over 255, default to % 255
-            ir = ir > 255 ? 255 : ir;
-            ig = ig > 255 ? 255 : ig;
-            ib = ib > 255 ? 255 : ib;
+    if (denoiseImage || aovPrefix != NULL) {
+        auto denoiseStart = chrono::steady_clock::now();
+        tile band = {0, distributionSliceBegin, nx, distributionSliceBegin + distributionSliceRange};
+        vector<pixel_features> features(size_t(nx) * distributionSliceRange);
+        for (size_t t = 0; t < tiles.size(); t++) {
+            tile current = tiles[t];
+            pool.submit([&, current]() {
+                render_tile_features(context, current, distributionSliceBegin, features);
+            });
+        }
+        pool.wait();
+        if (aovPrefix != NULL) {
+            // every feature is written as a PFM image of its own
+            const char *names[3] = {"albedo", "normal", "depth"};
+            vector<vec3> values(features.size());
+            for (int f = 0; f < 3; f++) {
+                for (size_t p = 0; p < features.size(); p++)
+                    values[p] = f == 0 ? features[p].albedo : f == 1 ? features[p].normal :
+                                                              vec3(features[p].depth, features[p].depth,
+                                                                   features[p].depth);
+                string path = string(aovPrefix) + "_" + names[f] + ".pfm";
+                image_file aov;
+                if (!aov.open(path.c_str(), nx, ny, IMAGE_PFM))
+                    return 1;
+                aov.write_tile(band, &values[0]);
+                if (!aov.close())
+                    return 1;
+            }
+        }
+        if (denoiseImage) {
+            // the noisy tiles written while rendering are replaced by the denoised band
+            vector<vec3> colors;
+            denoise(pool, nx, distributionSliceRange, bandEstimates, features, colors);
+            output.write_tile(band, &colors[0]);
+        }
+        printf("\033[K%s (%f s)\n", denoiseImage ? "Denoised" : "Wrote the AOVs",
+               chrono::duration<double>(chrono::steady_clock::now() - denoiseStart).count());
+    }
 
-            string s = to_string(ir) + " " + to_string(ig) + " " + to_string(ib) + "\n";
-            OutFile << s;
+    if (!output.close())
+        return 1;
 
+    // write where the samples went, brighter pixels took more samples
+    ofstream heatmapFile("spp_heatmap.ppm");
+    heatmapFile << "P3\n" << nx << " " << distributionSliceRange << "\n255\n";
+    long long totalSamples = 0;
+    for (int j = distributionSliceRange - 1; j >= 0; j--) {
+        for (int i = 0; i < nx; i++) {
+            int samples = sampleCounts[j * nx + i];
+            vec3 heat = heatmap_color(samples, adaptive);
+            heatmapFile << int(255.99 * heat[0]) << " " << int(255.99 * heat[1]) << " " << int(255.99 * heat[2]) << "\n";
+            totalSamples += samples;
         }
-#ifndef verbose
-        printf("Row %d completed\n", j);
-#endif
-        OutFile.close();
     }
-#ifdef verbose // use compiler macro to reduce runtime calculation
-    printf("\033[s\033[%dA\033[KWorker %d: completed (%f s)\033[u", processesCount - workerID, workerID,
-           (chrono::system_clock::now() - start).count() / pow(10, 6));
-#endif
+    heatmapFile.close();
+
+    printf("\033[KCompleted (%f s), %.1f samples per pixel on average\n",
+           chrono::duration<double>(chrono::system_clock::now() - start).count(),
+           double(totalSamples) / sampleCounts.size());
+    if (const lazy_bvh *tree = dynamic_cast<const lazy_bvh *>(world.world))
+        printf("BVH: %d nodes made while rendering\n", tree->node_count() - tree->eager_nodes);
 
     cout.flush();
 
 }
-
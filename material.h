@@ -10,6 +10,8 @@ struct hit_record;
 #include "ray.h"
 #include "hitable.h"
 #include "texture.h"
+#include "sampler.h"
+#include "onb.h"
 
 // Solve schlick function 
 float schlick(float cosine, float ref_idx) {
@@ -38,55 +40,146 @@ vec3 reflect(const vec3& v, const vec3& n) {
 
 
 // Return a random point inside the bounding box of the sphere
-vec3 random_in_unit_sphere() {
+vec3 random_in_unit_sphere(sampler &rng) {
     vec3 p;
     do {
-        p = 2.0*vec3(drand48(),drand48(),drand48()) - vec3(1,1,1);
+        p = 2.0*vec3(rng.next(),rng.next(),rng.next()) - vec3(1,1,1);
     } while (dot(p,p) >= 1.0);
     return p;
 }
 
 
+// a random direction around the normal n, with density cos(theta) / pi
+vec3 random_cosine_direction(const vec3 &n, sampler &rng) {
+    float r1 = rng.next();
+    float r2 = rng.next();
+    float phi = 2 * M_PI * r1;
+    float r = sqrt(r2);
+    return onb(n).local(cos(phi) * r, sin(phi) * r, sqrt(1 - r2));
+}
+
+
+// the outcome of sampling a material
+struct scatter_record {
+    ray scattered;      // the new ray
+    vec3 attenuation;   // eval() / pdf(): what the throughput of the path is multiplied by
+    float pdf;          // density of the direction of scattered per unit solid angle, 0 for delta materials
+};
+
+
+// the built-in materials, so the wavefront renderer can shade each kind in its own loop without virtual calls
+enum material_kind {
+    MATERIAL_LAMBERTIAN,
+    MATERIAL_METAL,
+    MATERIAL_DIELECTRIC,
+    MATERIAL_DIFFUSE_LIGHT,
+    MATERIAL_ISOTROPIC,
+    MATERIAL_OTHER,
+    MATERIAL_KIND_COUNT
+};
+
+
 class material  {
 public:
-    //
-    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const = 0;
+    material(material_kind k = MATERIAL_OTHER) : kind(k) {}
+
+    // Pick a direction for the light to continue in. Returns false if the light is absorbed
+    virtual bool sample(const ray& r_in, const hit_record& rec, sampler &rng, scatter_record& srec) const = 0;
     // r_in: input ray
     // rec: ray hitting recording
-    // attenuation: vec3 decay
-    // scattered: refracted light
+    // rng: random numbers of the current path
+    // srec: scattered ray, attenuation and density
+
+    // Fraction of the light arriving from direction wi that leaves towards the origin of r_in,
+    // per unit solid angle and including the cosine term
+    virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        return vec3(0,0,0);}
+
+    // Density of sample() picking the direction wi, per unit solid angle
+    virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        return 0;}
+
+    // Whether sample() picks from a discrete set of directions (perfect mirror, glass). Such materials cannot
+    // be evaluated for an arbitrary direction, so lights are not sampled at their hits
+    virtual bool is_delta() const { return false; }
+
+    // Color of the surface at a hit, the feature the denoiser demodulates and tells surfaces apart by. White for
+    // materials without one, e.g. glass
+    virtual vec3 reflectance(const hit_record& rec) const {
+        return vec3(1,1,1);}
 
     // Object not illuminated nor emits light. Returns black.
 
     virtual vec3 emitted(float u,float v,const vec3 &p)const {
         return vec3(0,0,0);}
+
+    material_kind kind;
 };
 
 
 class lambertian : public material { //basic lambertian material
 public:
-    lambertian(texture *color) : albedo(color) {}
-    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
-        vec3 target = rec.p + rec.normal + random_in_unit_sphere();
-        scattered = ray(rec.p, target-rec.p, r_in.time());
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
-        return true;
+    lambertian(texture *color) : material(MATERIAL_LAMBERTIAN), albedo(color) {}
+    // directions are sampled proportional to the cosine, so the attenuation is just the albedo
+    virtual bool sample(const ray& r_in, const hit_record& rec, sampler &rng, scatter_record& srec) const  {
+        srec.scattered = ray(rec.p, random_cosine_direction(rec.normal, rng), r_in.time());
+        srec.attenuation = texture_value(albedo, rec.u, rec.v, rec.p);
+        srec.pdf = lambertian::pdf(r_in, rec, srec.scattered.direction());
+        return srec.pdf > 0;
+    }
+    // albedo / pi * cos(theta)
+    virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        return texture_value(albedo, rec.u, rec.v, rec.p) * lambertian::pdf(r_in, rec, wi);
+    }
+    // cos(theta) / pi
+    virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        float cosine = dot(rec.normal, unit_vector(wi));
+        return cosine > 0 ? cosine / M_PI : 0;
+    }
+    virtual vec3 reflectance(const hit_record& rec) const {
+        return texture_value(albedo, rec.u, rec.v, rec.p);
     }
 
     texture *albedo;
 };
 
 // basic metal.
+// The reflected direction is perturbed by a random point in a sphere of radius fuzz, so the density of a direction
+// is the part of that sphere seen along it: (t2^3 - t1^3) / (4 pi fuzz^3) where t1, t2 are the distances at which
+// the direction enters and leaves the sphere. Without fuzz the metal is a perfect mirror
 class metal : public material {
 public:
     //constructor. All arguments in range [0,1]
-    metal(const vec3& color, float fuzziness) : albedo(color) { if (fuzziness < 1) fuzz = fuzziness; else fuzz = 1; }
-    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
+    metal(const vec3& color, float fuzziness) : material(MATERIAL_METAL), albedo(color) { if (fuzziness < 1) fuzz = fuzziness; else fuzz = 1; }
+    virtual bool sample(const ray& r_in, const hit_record& rec, sampler &rng, scatter_record& srec) const  {
         vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
-        attenuation = albedo;
-        return (dot(scattered.direction(), rec.normal) > 0);
+        srec.scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(rng), r_in.time());
+        srec.attenuation = albedo;
+        srec.pdf = metal::is_delta() ? 0 : metal::pdf(r_in, rec, srec.scattered.direction());
+        return (dot(srec.scattered.direction(), rec.normal) > 0);
     }
+    virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        return albedo * metal::pdf(r_in, rec, wi);
+    }
+    virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        if (metal::is_delta() || dot(wi, rec.normal) <= 0)
+            return 0;
+        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+        vec3 direction = unit_vector(wi);
+        // distances at which the direction crosses the sphere of radius fuzz around the reflected direction
+        float b = dot(direction, reflected);
+        float discriminant = b * b - dot(reflected, reflected) + fuzz * fuzz;
+        if (discriminant <= 0)
+            return 0;
+        float t2 = b + sqrt(discriminant);
+        float t1 = b - sqrt(discriminant);
+        t1 = t1 > 0 ? t1 : 0;
+        if (t2 <= t1)
+            return 0;
+        return (t2 * t2 * t2 - t1 * t1 * t1) / (4 * M_PI * fuzz * fuzz * fuzz);
+    }
+    virtual bool is_delta() const { return fuzz <= 0; }
+    virtual vec3 reflectance(const hit_record& rec) const { return albedo; }
     vec3 albedo;
     float fuzz;
 };
@@ -94,12 +187,13 @@ public:
 // dielectric material that refract lights, such as glass or water
 class dielectric : public material {
 public:
-    dielectric(float ri) : ref_idx(ri) {}
-    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
+    dielectric(float ri) : material(MATERIAL_DIELECTRIC), ref_idx(ri) {}
+    virtual bool sample(const ray& r_in, const hit_record& rec, sampler &rng, scatter_record& srec) const  {
         vec3 outward_normal;
         vec3 reflected = reflect(r_in.direction(), rec.normal);
         float ni_over_nt;
-        attenuation = vec3(1.0, 1.0, 1.0);
+        srec.attenuation = vec3(1.0, 1.0, 1.0);
+        srec.pdf = 0;
         vec3 refracted;
         float reflect_prob;
         float cosine;
@@ -119,12 +213,13 @@ public:
         else
             reflect_prob = 1.0;
         // randomly assign whether the light is refracted or reflected
-        if (drand48() < reflect_prob)
-            scattered = ray(rec.p, reflected);
+        if (rng.next() < reflect_prob)
+            srec.scattered = ray(rec.p, reflected, r_in.time());
         else
-            scattered = ray(rec.p, refracted);
+            srec.scattered = ray(rec.p, refracted, r_in.time());
         return true;
     }
+    virtual bool is_delta() const { return true; }
 
     float ref_idx;
 };
@@ -132,14 +227,14 @@ public:
 //basic light emitting material. Used to create a light source.
 class diffuse_light:public material {
 public:
-    diffuse_light(texture *a) : emit(a) {}
+    diffuse_light(texture *a) : material(MATERIAL_DIFFUSE_LIGHT), emit(a) {}
 
-    virtual bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const {
+    virtual bool sample(const ray &r_in, const hit_record &rec, sampler &rng, scatter_record &srec) const {
         return false;
     }
 
     virtual vec3 emitted(float u, float v, const vec3 &p) const {
-        return emit->value(u, v, p);
+        return texture_value(emit, u, v, p);
     }
 
     texture *emit;
@@ -148,12 +243,23 @@ public:
 // Basic isotropic material, such as smoke
 class isotropic : public material {
 public:
-    isotropic(texture *a) : albedo(a) {}
-    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
-        scattered = ray(rec.p, random_in_unit_sphere());
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
+    isotropic(texture *a) : material(MATERIAL_ISOTROPIC), albedo(a) {}
+    virtual bool sample(const ray& r_in, const hit_record& rec, sampler &rng, scatter_record& srec) const  {
+        srec.scattered = ray(rec.p, random_in_unit_sphere(rng), r_in.time());
+        srec.attenuation = texture_value(albedo, rec.u, rec.v, rec.p);
+        srec.pdf = 1 / (4 * M_PI);
         return true;
     }
+    // light is scattered equally into all directions
+    virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        return texture_value(albedo, rec.u, rec.v, rec.p) / (4 * M_PI);
+    }
+    virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        return 1 / (4 * M_PI);
+    }
+    virtual vec3 reflectance(const hit_record& rec) const {
+        return texture_value(albedo, rec.u, rec.v, rec.p);
+    }
     texture *albedo;
 };
 
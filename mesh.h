@@ -0,0 +1,587 @@
+// This file contains the triangle mesh and the loaders of OBJ and binary PLY files
+// A mesh is one hitable over all of its triangles. The vertices are stored once in flat buffers of floats that the
+// triangles index into, and a triangle is nothing but its three indices, so a mesh takes 12 bytes per vertex position
+// and 12 bytes per triangle plus its tree, instead of one heap object per triangle. The triangles are found through
+// a linear_bvh of their own, built when the mesh is made, with the triangle indices sorted into the order of its leaves
+// Rays are intersected with the Moller-Trumbore algorithm
+// Refer to the documentation for technical and mathematical details
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "hitable.h"
+#include "linear_bvh.h"
+#include "tokenizer.h"
+
+// the buffers of a mesh as a loader reads them
+struct mesh_buffers {
+    std::vector<float> positions;   // x, y, z of every vertex
+    std::vector<float> normals;     // x, y, z of every vertex, or empty
+    std::vector<float> uvs;         // u, v of every vertex, or empty
+    std::vector<int> indices;       // the three vertices of every triangle
+};
+
+// the distance t of the hit of r with the triangle p0 p1 p2 and the barycentric coordinates b1 and b2 of p1 and p2
+// at the hit. false if the ray misses the triangle or hits it outside (t_min, t_max)
+inline bool triangle_intersect(const vec3 &p0, const vec3 &p1, const vec3 &p2, const ray &r, float t_min,
+                               float t_max, float &t, float &b1, float &b2) {
+    vec3 e1 = p1 - p0;
+    vec3 e2 = p2 - p0;
+    vec3 pvec = cross(r.direction(), e2);
+    float det = dot(e1, pvec);
+    // the ray is parallel to the plane of the triangle
+    if (det == 0)
+        return false;
+    float inv_det = 1.0f / det;
+    vec3 tvec = r.origin() - p0;
+    b1 = dot(tvec, pvec) * inv_det;
+    if (b1 < 0 || b1 > 1)
+        return false;
+    vec3 qvec = cross(tvec, e1);
+    b2 = dot(r.direction(), qvec) * inv_det;
+    if (b2 < 0 || b1 + b2 > 1)
+        return false;
+    t = dot(e2, qvec) * inv_det;
+    return t > t_min && t < t_max;
+}
+
+// a mesh of triangles sharing indexed vertex, normal and uv buffers
+class triangle_mesh : public hitable {
+public:
+    // constructor. Takes the buffers over, leaving buffers empty, and builds the tree over the triangles, on threads
+    // if it is not NULL
+    triangle_mesh(mesh_buffers &buffers, material *m, bvh_builder builder = default_bvh_builder,
+                  thread_pool *threads = NULL);
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+
+    virtual bool bounding_box(float t0, float t1, aabb &box) const {
+        if (nodes.empty())
+            return false;
+        box = linear_bvh_bounds(nodes[0]);
+        return true;
+    }
+
+    virtual void complete(const ray &r, hit_record &rec) const;
+
+    vec3 vertex(int i) const { return vec3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]); }
+
+    int triangle_count() const { return int(indices.size() / 3); }
+
+    // bytes of the buffers and the tree
+    size_t memory() const {
+        return (positions.capacity() + normals.capacity() + uvs.capacity()) * sizeof(float) +
+               indices.capacity() * sizeof(int) + nodes.capacity() * sizeof(linear_bvh_node);
+    }
+
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> uvs;
+    std::vector<int> indices;               // the three vertices of every triangle, in the order of the leaves
+    std::vector<linear_bvh_node> nodes;     // the tree over the triangles
+    bvh_build_stats stats;                  // how the tree was built
+    material *mat_ptr;
+};
+
+triangle_mesh::triangle_mesh(mesh_buffers &buffers, material *m, bvh_builder builder, thread_pool *threads)
+        : mat_ptr(m) {
+    positions.swap(buffers.positions);
+    normals.swap(buffers.normals);
+    uvs.swap(buffers.uvs);
+    int n = int(buffers.indices.size() / 3);
+    if (n == 0)
+        return;
+    std::vector<bvh_primitive_info> prims(n);
+    for (int i = 0; i < n; i++) {
+        const int *v = &buffers.indices[3 * i];
+        vec3 p0 = vertex(v[0]), p1 = vertex(v[1]), p2 = vertex(v[2]);
+        vec3 min(fmin(p0[0], fmin(p1[0], p2[0])), fmin(p0[1], fmin(p1[1], p2[1])),
+                 fmin(p0[2], fmin(p1[2], p2[2])));
+        vec3 max(fmax(p0[0], fmax(p1[0], p2[0])), fmax(p0[1], fmax(p1[1], p2[1])),
+                 fmax(p0[2], fmax(p1[2], p2[2])));
+        prims[i].index = i;
+        prims[i].box = aabb(min, max);
+        prims[i].centroid = prims[i].box.centroid();
+    }
+    bvh_build(prims, builder, nodes, stats, threads);
+    indices.resize(3 * n);
+    for (int i = 0; i < n; i++)
+        for (int k = 0; k < 3; k++)
+            indices[3 * i + k] = buffers.indices[3 * prims[i].index + k];
+    std::vector<int>().swap(buffers.indices);
+}
+
+// intersects the triangles of a leaf of the tree of a mesh
+struct mesh_leaf {
+    mesh_leaf(const triangle_mesh &m, const ray &ray_in, float t, hit_record &record)
+            : mesh(m), r(ray_in), t_min(t), rec(record) {}
+
+    bool operator()(int first, int count, float &t_max) {
+        bool hit_anything = false;
+        for (int i = first; i < first + count; i++) {
+            const int *v = &mesh.indices[3 * i];
+            float t, b1, b2;
+            if (triangle_intersect(mesh.vertex(v[0]), mesh.vertex(v[1]), mesh.vertex(v[2]), r, t_min, t_max, t, b1,
+                                   b2)) {
+                hit_anything = true;
+                t_max = t;
+                rec.t = t;
+                rec.part = i;
+            }
+        }
+        return hit_anything;
+    }
+
+    const triangle_mesh &mesh;
+    const ray &r;
+    float t_min;
+    hit_record &rec;
+};
+
+// compute whether the ray hits a triangle of the mesh. part is the triangle hit
+bool triangle_mesh::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
+    if (nodes.empty())
+        return false;
+    mesh_leaf leaf(*this, r, t_min, rec);
+    if (!linear_bvh_traverse(&nodes[0], r, t_min, t_max, leaf))
+        return false;
+    rec.object = this;
+    return true;
+}
+
+// the point, normal and uv of the hit, interpolated over the triangle. Without normals the normal is that of the
+// plane of the triangle, facing the side its vertices go around counterclockwise, and without uvs the barycentric
+// coordinates are the uv
+void triangle_mesh::complete(const ray &r, hit_record &rec) const {
+    const int *v = &indices[3 * rec.part];
+    vec3 p0 = vertex(v[0]), p1 = vertex(v[1]), p2 = vertex(v[2]);
+    // the barycentric coordinates as in triangle_intersect(), without its range checks
+    vec3 e1 = p1 - p0;
+    vec3 e2 = p2 - p0;
+    vec3 pvec = cross(r.direction(), e2);
+    float inv_det = 1.0f / dot(e1, pvec);
+    vec3 tvec = r.origin() - p0;
+    float b1 = dot(tvec, pvec) * inv_det;
+    float b2 = dot(r.direction(), cross(tvec, e1)) * inv_det;
+    float b0 = 1 - b1 - b2;
+    rec.p = r.point_at_parameter(rec.t);
+    vec3 normal = cross(e1, e2);
+    if (!normals.empty()) {
+        const float *n0 = &normals[3 * v[0]], *n1 = &normals[3 * v[1]], *n2 = &normals[3 * v[2]];
+        vec3 shading(b0 * n0[0] + b1 * n1[0] + b2 * n2[0], b0 * n0[1] + b1 * n1[1] + b2 * n2[1],
+                     b0 * n0[2] + b1 * n1[2] + b2 * n2[2]);
+        if (dot(shading, shading) > 0)
+            normal = shading;
+    }
+    rec.normal = unit_vector(normal);
+    if (!uvs.empty()) {
+        rec.u = b0 * uvs[2 * v[0]] + b1 * uvs[2 * v[1]] + b2 * uvs[2 * v[2]];
+        rec.v = b0 * uvs[2 * v[0] + 1] + b1 * uvs[2 * v[1] + 1] + b2 * uvs[2 * v[2] + 1];
+    } else {
+        rec.u = b1;
+        rec.v = b2;
+    }
+    rec.mat_ptr = mat_ptr;
+}
+
+// whether every triangle points at vertices that exist. false, after printing why, if not
+bool mesh_buffers_valid(const char *path, const mesh_buffers &mesh) {
+    size_t vertices = mesh.positions.size() / 3;
+    for (size_t i = 0; i < mesh.indices.size(); i++) {
+        if (mesh.indices[i] < 0 || size_t(mesh.indices[i]) >= vertices) {
+            fprintf(stderr, "%s: triangle %zu uses vertex %d of %zu\n", path, i / 3, mesh.indices[i] + 1, vertices);
+            return false;
+        }
+    }
+    if ((!mesh.normals.empty() && mesh.normals.size() != 3 * vertices) ||
+        (!mesh.uvs.empty() && mesh.uvs.size() != 2 * vertices)) {
+        fprintf(stderr, "%s: the normals or uvs do not match the vertices\n", path);
+        return false;
+    }
+    return true;
+}
+
+// a corner of an OBJ face: the indices of its position, uv and normal, -1 where it has none
+struct obj_corner {
+    int v, vt, vn;
+
+    bool operator==(const obj_corner &o) const { return v == o.v && vt == o.vt && vn == o.vn; }
+};
+
+struct obj_corner_hash {
+    size_t operator()(const obj_corner &c) const {
+        return (size_t(c.v) * 73856093u) ^ (size_t(c.vt) * 19349663u) ^ (size_t(c.vn) * 83492791u);
+    }
+};
+
+// the index of an OBJ element from its number in a face. Numbers count from 1, negative ones back from the last
+// element read. -1 if there is no such element
+inline int obj_index(const char *text, char **end, size_t count) {
+    long i = strtol(text, end, 10);
+    if (*end == text)
+        return -1;
+    long index = i < 0 ? long(count) + i : i - 1;
+    return index >= 0 && size_t(index) < count ? int(index) : -1;
+}
+
+// Read the triangles of the Wavefront OBJ file at path: the v, vt, vn and f statements. Faces with more than three
+// corners are split into a fan of triangles, everything else is ignored. When all corners name a uv or a normal,
+// vertices with the same position but different uvs or normals are split, so one index per corner finds all three
+// false, after printing why, if the file cannot be read
+bool load_obj(const char *path, mesh_buffers &mesh) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "cannot open mesh %s\n", path);
+        return false;
+    }
+    text_tokenizer in(f);
+    std::vector<float> positions, uvs, normals;
+    // the corners of the triangles, three after the other
+    std::vector<obj_corner> corners;
+    bool all_uvs = true, all_normals = true;
+    std::vector<obj_corner> face;
+    bool ok = true;
+    while (ok && in.next_line()) {
+        const char *keyword = in.next();
+        if (strcmp(keyword, "v") == 0 || strcmp(keyword, "vn") == 0 || strcmp(keyword, "vt") == 0) {
+            std::vector<float> &target = keyword[1] == 'n' ? normals : keyword[1] == 't' ? uvs : positions;
+            int components = keyword[1] == 't' ? 2 : 3;
+            for (int c = 0; c < components; c++) {
+                const char *t = in.next();
+                char *end;
+                // a uv may leave out its v
+                float value = t == NULL && c == 1 ? 0 : t == NULL ? 0 : strtof(t, &end);
+                if ((t == NULL && c != 1) || (t != NULL && (end == t || *end != '\0'))) {
+                    fprintf(stderr, "%s:%d: bad %s\n", path, in.line_number(), keyword);
+                    ok = false;
+                    break;
+                }
+                target.push_back(value);
+            }
+        } else if (strcmp(keyword, "f") == 0) {
+            face.clear();
+            for (const char *t = in.next(); t != NULL; t = in.next()) {
+                // v, v/vt, v//vn or v/vt/vn
+                obj_corner c;
+                char *end;
+                c.v = obj_index(t, &end, positions.size() / 3);
+                c.vt = c.vn = -1;
+                if (c.v >= 0 && *end == '/') {
+                    const char *next = end + 1;
+                    if (*next != '/') {
+                        c.vt = obj_index(next, &end, uvs.size() / 2);
+                        if (c.vt < 0)
+                            c.v = -1;
+                    } else
+                        end = const_cast<char *>(next);
+                    if (c.v >= 0 && *end == '/') {
+                        c.vn = obj_index(end + 1, &end, normals.size() / 3);
+                        if (c.vn < 0)
+                            c.v = -1;
+                    }
+                }
+                if (c.v < 0 || *end != '\0') {
+                    fprintf(stderr, "%s:%d: bad face corner %s\n", path, in.line_number(), t);
+                    ok = false;
+                    break;
+                }
+                all_uvs = all_uvs && c.vt >= 0;
+                all_normals = all_normals && c.vn >= 0;
+                face.push_back(c);
+            }
+            if (ok && face.size() < 3) {
+                fprintf(stderr, "%s:%d: a face needs three corners\n", path, in.line_number());
+                ok = false;
+            }
+            for (size_t i = 1; ok && i + 1 < face.size(); i++) {
+                corners.push_back(face[0]);
+                corners.push_back(face[i]);
+                corners.push_back(face[i + 1]);
+            }
+        }
+    }
+    if (ok && in.failed()) {
+        fprintf(stderr, "%s: read error\n", path);
+        ok = false;
+    }
+    fclose(f);
+    if (!ok)
+        return false;
+
+    if (!all_uvs && !all_normals) {
+        // the positions are the vertices
+        mesh.positions.swap(positions);
+        mesh.indices.resize(corners.size());
+        for (size_t i = 0; i < corners.size(); i++)
+            mesh.indices[i] = corners[i].v;
+    } else {
+        // every different corner is a vertex of its own
+        std::unordered_map<obj_corner, int, obj_corner_hash> vertices;
+        mesh.indices.resize(corners.size());
+        for (size_t i = 0; i < corners.size(); i++) {
+            obj_corner c = corners[i];
+            if (!all_uvs)
+                c.vt = -1;
+            if (!all_normals)
+                c.vn = -1;
+            std::pair<std::unordered_map<obj_corner, int, obj_corner_hash>::iterator, bool> added =
+                    vertices.insert(std::make_pair(c, int(vertices.size())));
+            if (added.second) {
+                mesh.positions.insert(mesh.positions.end(), &positions[3 * c.v], &positions[3 * c.v] + 3);
+                if (all_uvs)
+                    mesh.uvs.insert(mesh.uvs.end(), &uvs[2 * c.vt], &uvs[2 * c.vt] + 2);
+                if (all_normals)
+                    mesh.normals.insert(mesh.normals.end(), &normals[3 * c.vn], &normals[3 * c.vn] + 3);
+            }
+            mesh.indices[i] = added.first->second;
+        }
+    }
+    return mesh_buffers_valid(path, mesh);
+}
+
+// the scalar types of PLY properties
+enum ply_type {
+    PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID
+};
+
+// the type of a PLY type name, both the old and the sized names
+inline ply_type parse_ply_type(const char *name) {
+    const char *names[] = {"char", "uchar", "short", "ushort", "int", "uint", "float", "double",
+                           "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64"};
+    for (int i = 0; i < 16; i++)
+        if (strcmp(name, names[i]) == 0)
+            return ply_type(i % 8);
+    return PLY_INVALID;
+}
+
+// bytes of a value of a PLY type
+inline int ply_type_size(ply_type type) {
+    static const int sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+    return sizes[type];
+}
+
+struct ply_property {
+    std::string name;
+    ply_type type;          // the type of the values
+    ply_type count_type;    // the type of the length of a list, PLY_INVALID for a single value
+};
+
+struct ply_element {
+    std::string name;
+    size_t count;
+    std::vector<ply_property> properties;
+};
+
+// reads the values of the body of a binary PLY file through a buffer
+class ply_reader {
+public:
+    ply_reader(FILE *f, bool swap_bytes) : file(f), buffer(1 << 20), pos(0), len(0), swap(swap_bytes) {}
+
+    // the next value of the given type. false at the end of the file
+    bool read(ply_type type, double &value) {
+        unsigned char bytes[8];
+        int size = ply_type_size(type);
+        for (int i = 0; i < size; i++) {
+            if (pos == len) {
+                len = fread(&buffer[0], 1, buffer.size(), file);
+                pos = 0;
+                if (len == 0)
+                    return false;
+            }
+            bytes[swap ? size - 1 - i : i] = buffer[pos++];
+        }
+        switch (type) {
+            case PLY_INT8:
+                value = *reinterpret_cast<int8_t *>(bytes);
+                break;
+            case PLY_UINT8:
+                value = bytes[0];
+                break;
+            case PLY_INT16:
+                value = scalar<int16_t>(bytes);
+                break;
+            case PLY_UINT16:
+                value = scalar<uint16_t>(bytes);
+                break;
+            case PLY_INT32:
+                value = scalar<int32_t>(bytes);
+                break;
+            case PLY_UINT32:
+                value = scalar<uint32_t>(bytes);
+                break;
+            case PLY_FLOAT32:
+                value = scalar<float>(bytes);
+                break;
+            default:
+                value = scalar<double>(bytes);
+        }
+        return true;
+    }
+
+private:
+    template<class T>
+    static T scalar(const unsigned char *bytes) {
+        T v;
+        memcpy(&v, bytes, sizeof(T));
+        return v;
+    }
+
+    FILE *file;
+    std::vector<unsigned char> buffer;
+    size_t pos, len;
+    bool swap;      // the file has the other byte order than the machine
+};
+
+// Read the triangles of the binary PLY file at path: the x, y, z, nx, ny, nz and u, v (or s, t) properties of the
+// vertex element and the vertex_indices list of the face element. Faces with more than three corners are split into
+// a fan of triangles, other elements and properties are skipped. false, after printing why, if the file cannot be
+// read, is an ascii PLY file or has no vertex positions
+bool load_ply(const char *path, mesh_buffers &mesh) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "cannot open mesh %s\n", path);
+        return false;
+    }
+    // the header is text, one statement per line, up to end_header
+    std::vector<ply_element> elements;
+    char line[1024];
+    bool little_endian = true, format = false, ended = false, ok = true;
+    if (fgets(line, sizeof(line), f) == NULL || strncmp(line, "ply", 3) != 0) {
+        fprintf(stderr, "%s: not a PLY file\n", path);
+        ok = false;
+    }
+    while (ok && !ended && fgets(line, sizeof(line), f) != NULL) {
+        char *words[8];
+        int n = 0;
+        for (char *w = strtok(line, " \t\r\n"); w != NULL && n < 8; w = strtok(NULL, " \t\r\n"))
+            words[n++] = w;
+        if (n == 0)
+            continue;
+        if (strcmp(words[0], "format") == 0 && n >= 2) {
+            format = strcmp(words[1], "binary_little_endian") == 0 || strcmp(words[1], "binary_big_endian") == 0;
+            little_endian = strcmp(words[1], "binary_little_endian") == 0;
+            if (!format) {
+                fprintf(stderr, "%s: only binary PLY files are supported, not %s\n", path, words[1]);
+                ok = false;
+            }
+        } else if (strcmp(words[0], "element") == 0 && n >= 3) {
+            ply_element e;
+            e.name = words[1];
+            e.count = size_t(strtoull(words[2], NULL, 10));
+            elements.push_back(e);
+        } else if (strcmp(words[0], "property") == 0 && !elements.empty()) {
+            ply_property p;
+            bool list = n >= 5 && strcmp(words[1], "list") == 0;
+            p.count_type = list ? parse_ply_type(words[2]) : PLY_INVALID;
+            p.type = parse_ply_type(words[list ? 3 : 1]);
+            p.name = n >= (list ? 5 : 3) ? words[list ? 4 : 2] : "";
+            if (p.type == PLY_INVALID || (list && p.count_type == PLY_INVALID) || p.name.empty()) {
+                fprintf(stderr, "%s: bad property\n", path);
+                ok = false;
+            }
+            elements.back().properties.push_back(p);
+        } else if (strcmp(words[0], "end_header") == 0)
+            ended = true;
+    }
+    if (ok && (!ended || !format)) {
+        fprintf(stderr, "%s: incomplete PLY header\n", path);
+        ok = false;
+    }
+
+    const uint16_t one = 1;
+    bool machine_little_endian = *reinterpret_cast<const unsigned char *>(&one) == 1;
+    ply_reader reader(f, little_endian != machine_little_endian);
+    bool has_normals = false, has_uvs = false;
+    std::vector<int> face;
+    for (size_t e = 0; ok && e < elements.size(); e++) {
+        const ply_element &element = elements[e];
+        bool vertices = element.name == "vertex";
+        bool faces = element.name == "face";
+        // where each property goes: 0-2 position, 3-5 normal, 6-7 uv, 8 the corners of a face, -1 nowhere
+        std::vector<int> slot(element.properties.size(), -1);
+        for (size_t p = 0; p < element.properties.size(); p++) {
+            const std::string &name = element.properties[p].name;
+            const char *slots[] = {"x", "y", "z", "nx", "ny", "nz", "u", "v", "s", "t", "texture_u", "texture_v"};
+            for (int s = 0; vertices && s < 12; s++)
+                if (name == slots[s])
+                    slot[p] = s < 8 ? s : 6 + (s % 2);
+            if (faces && (name == "vertex_indices" || name == "vertex_index"))
+                slot[p] = 8;
+        }
+        int found = 0;
+        for (size_t p = 0; p < slot.size(); p++)
+            if (slot[p] >= 0)
+                found |= 1 << slot[p];
+        if (vertices) {
+            if ((found & 7) != 7) {
+                fprintf(stderr, "%s: the vertices have no x, y and z\n", path);
+                ok = false;
+                break;
+            }
+            has_normals = (found & 0x38) == 0x38;
+            has_uvs = (found & 0xc0) == 0xc0;
+            mesh.positions.reserve(3 * element.count);
+            if (has_normals)
+                mesh.normals.reserve(3 * element.count);
+            if (has_uvs)
+                mesh.uvs.reserve(2 * element.count);
+        }
+        if (faces)
+            mesh.indices.reserve(3 * element.count);
+        for (size_t i = 0; ok && i < element.count; i++) {
+            float values[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+            for (size_t p = 0; ok && p < element.properties.size(); p++) {
+                const ply_property &property = element.properties[p];
+                double value;
+                if (property.count_type == PLY_INVALID) {
+                    ok = reader.read(property.type, value);
+                    if (slot[p] >= 0 && slot[p] < 8)
+                        values[slot[p]] = float(value);
+                    continue;
+                }
+                double count;
+                ok = reader.read(property.count_type, count);
+                face.clear();
+                for (long k = 0; ok && k < long(count); k++) {
+                    ok = reader.read(property.type, value);
+                    face.push_back(int(value));
+                }
+                if (ok && slot[p] == 8) {
+                    for (size_t k = 1; k + 1 < face.size(); k++) {
+                        mesh.indices.push_back(face[0]);
+                        mesh.indices.push_back(face[k]);
+                        mesh.indices.push_back(face[k + 1]);
+                    }
+                }
+            }
+            if (vertices) {
+                mesh.positions.insert(mesh.positions.end(), values, values + 3);
+                if (has_normals)
+                    mesh.normals.insert(mesh.normals.end(), values + 3, values + 6);
+                if (has_uvs)
+                    mesh.uvs.insert(mesh.uvs.end(), values + 6, values + 8);
+            }
+        }
+        if (!ok)
+            fprintf(stderr, "%s: the file ends inside element %s\n", path, element.name.c_str());
+    }
+    fclose(f);
+    return ok && mesh_buffers_valid(path, mesh);
+}
+
+// load the mesh at path, an OBJ or a binary PLY file told apart by the extension
+bool load_mesh(const char *path, mesh_buffers &mesh) {
+    size_t length = strlen(path);
+    if (length >= 4 && strcasecmp(path + length - 4, ".ply") == 0)
+        return load_ply(path, mesh);
+    return load_obj(path, mesh);
+}
+
+#endif //MESH_H
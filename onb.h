@@ -0,0 +1,33 @@
+// This file contains the orthonormal basis, a local coordinate frame around a direction
+// It is used to turn directions sampled around the z axis into directions around a normal or towards a light
+
+#ifndef ONB_H
+#define ONB_H
+
+#include "vec3.h"
+
+class onb {
+public:
+    onb() {}
+
+    // constructor. w points along n, u and v are perpendicular to it
+    onb(const vec3 &n) {
+        axis[2] = unit_vector(n);
+        vec3 a = fabs(axis[2].x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        axis[1] = unit_vector(cross(axis[2], a));
+        axis[0] = cross(axis[2], axis[1]);
+    }
+
+    vec3 u() const { return axis[0]; }
+
+    vec3 v() const { return axis[1]; }
+
+    vec3 w() const { return axis[2]; }
+
+    // the direction with coordinates (a, b, c) in this basis
+    vec3 local(float a, float b, float c) const { return a * axis[0] + b * axis[1] + c * axis[2]; }
+
+    vec3 axis[3];
+};
+
+#endif //ONB_H
@@ -0,0 +1,82 @@
+// This file contains ray packets, small groups of rays that are traced together
+// Neighbouring camera rays, and shadow rays towards the same light, take nearly the same way through the scene.
+// Traced as a packet they share every node visit of the bvh: a subtree is skipped as soon as no ray of the packet
+// hits its box, and the rays are tested against a box or a primitive in one loop over the lanes that the compiler
+// turns into SIMD instructions. Which lanes take part is given by a bit mask
+// See *Interactive Rendering with Coherent Ray Tracing* by Wald, Slusallek, Benthin and Wagner
+
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "ray.h"
+#include "aabb.h"
+
+// rays per packet: 4, 8 or 16. Defaults to the number of floats in a vector register
+#ifndef RAY_PACKET_SIZE
+#if defined(__AVX__)
+#define RAY_PACKET_SIZE 8
+#else
+#define RAY_PACKET_SIZE 4
+#endif
+#endif
+
+const int packet_size = RAY_PACKET_SIZE;
+
+static_assert(packet_size == 4 || packet_size == 8 || packet_size == 16, "ray packets hold 4, 8 or 16 rays");
+
+// mask with every lane of a packet set
+const int packet_all = (1 << packet_size) - 1;
+
+// the rays of a packet as a structure of arrays
+struct ray_packet {
+    // store r in a lane
+    void set(int lane, const ray &r) {
+        for (int a = 0; a < 3; a++) {
+            origin[a][lane] = r.A[a];
+            direction[a][lane] = r.B[a];
+            inv_direction[a][lane] = 1.0f / r.B[a];
+        }
+        time[lane] = r.time();
+    }
+
+    ray get(int lane) const {
+        return ray(vec3(origin[0][lane], origin[1][lane], origin[2][lane]),
+                   vec3(direction[0][lane], direction[1][lane], direction[2][lane]), time[lane]);
+    }
+
+    float origin[3][packet_size];
+    float direction[3][packet_size];
+    float inv_direction[3][packet_size];
+    float time[packet_size];
+};
+
+// bit mask of the lanes whose flag is set
+inline int packet_mask(const int *flags, int mask) {
+    int result = 0;
+    for (int l = 0; l < packet_size; l++)
+        result |= flags[l] << l;
+    return result & mask;
+}
+
+// slab test of a box against the lanes in mask, each with its own t_max. Returns the lanes that hit the box, and
+// where every lane enters it in t_near
+inline int packet_box_hit(const float *box_min, const float *box_max, const ray_packet &p, int mask, float t_min,
+                          const float *t_max, float *t_near) {
+    int hit[packet_size];
+    for (int l = 0; l < packet_size; l++) {
+        float t0 = t_min;
+        float t1 = t_max[l];
+        for (int a = 0; a < 3; a++) {
+            float inv = p.inv_direction[a][l];
+            float n = ((inv < 0 ? box_max[a] : box_min[a]) - p.origin[a][l]) * inv;
+            float f = ((inv < 0 ? box_min[a] : box_max[a]) - p.origin[a][l]) * inv * aabb_far_scale;
+            t0 = n > t0 ? n : t0;
+            t1 = f < t1 ? f : t1;
+        }
+        t_near[l] = t0;
+        hit[l] = t0 <= t1;
+    }
+    return packet_mask(hit, mask);
+}
+
+#endif //PACKET_H
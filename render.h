@@ -0,0 +1,82 @@
+// This file renders tiles of the image. A tile is sampled adaptively, every pixel takes batches of samples until its
+// estimate is good enough. Every sample has its own random sequence, seeded from the pixel and the sample index, so
+// the image does not depend on which thread renders it
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <vector>
+#include <string.h>
+#include "camera.h"
+#include "hitable.h"
+#include "sampler.h"
+#include "tile.h"
+#include "adaptive.h"
+#include "integrator.h"
+
+// how the paths of a tile are followed
+enum render_engine {
+    ENGINE_PATH,       // one path after the other, render_tile_path()
+    ENGINE_WAVEFRONT   // all paths of a batch together, one bounce at a time, render_tile_wavefront()
+};
+
+// parse the name of a render engine. Returns false for an unknown name
+bool parse_engine(const char *name, render_engine &engine) {
+    if (strcmp(name, "path") == 0)
+        engine = ENGINE_PATH;
+    else if (strcmp(name, "wavefront") == 0)
+        engine = ENGINE_WAVEFRONT;
+    else
+        return false;
+    return true;
+}
+
+// everything a tile needs to be rendered
+struct render_context {
+    const camera *cam;
+    hitable *world;
+    hitable *lights;
+    int nx, ny;  // image size
+    adaptive_settings adaptive;
+    integrator_settings paths;
+};
+
+// convert a NaN result to a usable result
+// refer to documentation for details
+inline vec3 de_nan(const vec3 &c) { //
+    vec3 t = c;
+    if (!(t[0] == t[0]))
+        t[0] = 0;
+    if (!(t[1] == t[1]))
+        t[1] = 0;
+    if (!(t[2] == t[2]))
+        t[2] = 0;
+    return t;
+}
+
+// the random sequence of a sample, and the camera ray through a random point of its pixel
+inline ray camera_sample(const render_context &ctx, int i, int j, int sample_index, sampler &rng) {
+    rng = sampler(uint64_t(j) * ctx.nx + i, sample_index);
+    float u = float(i + rng.next()) / float(ctx.nx);
+    float v = float(j + rng.next()) / float(ctx.ny);
+    return ctx.cam->get_ray(u, v, rng);
+}
+
+// render a tile one pixel at a time, following each path to its end before the next starts
+// estimates holds the tile's pixels row by row, starting at (x0, y0)
+void render_tile_path(const render_context &ctx, const tile &t, std::vector<pixel_estimate> &estimates) {
+    for (int j = t.y1 - 1; j >= t.y0; j--) {
+        for (int i = t.x0; i < t.x1; i++) {
+            pixel_estimate &estimate = estimates[(j - t.y0) * t.width() + (i - t.x0)];
+            while (!estimate.done(ctx.adaptive)) {
+                for (int b = 0; b < ctx.adaptive.batch && estimate.samples < ctx.adaptive.max_samples; b++) {
+                    sampler rng;
+                    ray r = camera_sample(ctx, i, j, estimate.samples, rng);
+                    estimate.add(de_nan(color(r, ctx.world, ctx.lights, ctx.paths, rng)));
+                }
+            }
+        }
+    }
+}
+
+#endif //RENDER_H
@@ -0,0 +1,56 @@
+// This file contains the sampler, the random number generator carried along with every path
+// It is a PCG32 generator (*PCG: A Family of Simple Fast Space-Efficient Statistically Good Algorithms for Random
+// Number Generation* by Melissa O'Neill). Every sample of every pixel gets its own deterministic sequence, so
+// threads never share state and an image comes out the same no matter how the work is split
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+
+// scramble a 64 bit value (splitmix64 finalizer)
+inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+class sampler {
+public:
+    sampler() { seed(0, 0); }
+
+    // constructor. Starts the sequence of one sample of one pixel
+    sampler(uint64_t pixel, uint64_t sample_index) { seed(pixel, sample_index); }
+
+    // restart at the sequence of one sample of one pixel
+    void seed(uint64_t pixel, uint64_t sample_index) {
+        state = 0;
+        inc = (mix64(pixel + 0x9e3779b97f4a7c15ULL) << 1) | 1;
+        next_uint();
+        state += mix64(sample_index ^ (pixel << 32) ^ 0x2545f4914f6cdd1dULL);
+        next_uint();
+    }
+
+    // next random 32 bit integer
+    inline uint32_t next_uint() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+        uint32_t rot = uint32_t(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    // next random float in [0, 1), a drop-in for drand48()
+    inline float next() {
+        return (next_uint() >> 8) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+#endif //SAMPLER_H
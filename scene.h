@@ -3,11 +3,17 @@
 #ifndef RAY_TRACER_SCENE_H
 #define RAY_TRACER_SCENE_H
 
+#include <stdio.h>
 #include "hitable.h"
 #include "material.h"
 #include "aarect.h"
 #include "box.h"
 #include "sphere.h"
+#include "accel.h"
+#include "arena.h"
+#include "camera.h"
+#include "adaptive.h"
+#include "integrator.h"
 
 // convert rgb value to a vec3 bounded by [0.0,1.0]
 vec3 rgb(float r, float g, float b) {
@@ -15,65 +21,146 @@ vec3 rgb(float r, float g, float b) {
 }
 
 
-// Scene Construction
-hitable *scene() {
-    int i = 0;
-    hitable **list = new hitable *[25];
-    material *rightWall = new lambertian(new constant_texture(rgb(0xb0, 0x7a, 0x29)));
+// what gets rendered
+struct scene_description {
+    hitable *world;     // all objects, wrapped in an acceleration structure
+    hitable *lights;    // the emitters among them, sampled directly by the integrator. NULL without emitters
+    bvh_build_stats build;  // how the tree around world was built, all zero when none was built
+};
+
+// where the camera stands and what it looks at
+struct camera_settings {
+    vec3 lookfrom, lookat, vup;
+    float vfov;         // vertical field of view in degrees
+    float aperture;     // diameter of the lens, 0 for a pinhole
+    float focus_dist;   // distance of the plane in focus
+    float time0, time1; // the shutter is open in between
+};
+
+// how the scene is rendered. A scene file sets these along with the objects
+struct scene_settings {
+    int nx, ny;         // pixel count (x,y)
+    adaptive_settings adaptive;
+    integrator_settings paths;
+    camera_settings view;
+};
+
+// the settings of the built-in scene
+scene_settings default_scene_settings() {
+    scene_settings settings;
+    settings.nx = 4096;
+    settings.ny = 4096;
+    // Sampling Size. Pixels are sampled in batches until their relative error is low enough
+    settings.adaptive.min_samples = 256;
+    settings.adaptive.max_samples = 100000;
+    settings.adaptive.batch = 64;
+    settings.adaptive.max_relative_error = 0.01;
+    // Path length
+    settings.paths.max_depth = 50;
+    settings.paths.rr_depth = 5;
+    // Camera View
+    settings.view.lookfrom = vec3(500, 500, -1300);
+    settings.view.lookat = vec3(500, 500, 1000);
+    settings.view.vup = vec3(0, 1, 0);
+    settings.view.vfov = 40.0;
+    settings.view.aperture = 0.0;
+    settings.view.focus_dist = 10.0;
+    settings.view.time0 = 0.0;
+    settings.view.time1 = 1.0;
+    return settings;
+}
+
+// the camera described by the settings, for an image of nx by ny pixels
+camera make_camera(const scene_settings &settings) {
+    const camera_settings &v = settings.view;
+    return camera(v.lookfrom, v.lookat, v.vup, v.vfov, float(settings.nx) / float(settings.ny), v.aperture,
+                  v.focus_dist, v.time0, v.time1);
+}
 
-    material *ceiling = new lambertian(new constant_texture(rgb(0xff, 0xe8, 0xe0)));
-    material *ground = new metal(rgb(0xff, 0xe8, 0xe0), 0.15);
-    material *backWall = new lambertian(new constant_texture(rgb(245, 208, 184)));
+// print how much memory the scene in storage takes
+void print_scene_memory(const char *name, const arena &storage) {
+    printf("%s: %zu objects, %.1f KiB in the arena (%.1f KiB reserved), %.1f KiB in bvh and mesh arrays\n", name,
+           storage.object_count(), storage.bytes_used() / 1024.0, storage.bytes_reserved() / 1024.0,
+           storage.bytes_external() / 1024.0);
+}
 
-    material *leftWall = new lambertian(new constant_texture(rgb(0x60, 0x4e, 0xc9)));
-    material *pillar = new isotropic(new constant_texture(rgb(128, 128, 128)));
-    material *beacon = new diffuse_light(new constant_texture(rgb(53, 89, 180) * 17.5));
-    material *smoke = new isotropic(new constant_texture(rgb(255, 255, 255)));
-    material *noise = new lambertian(new noise_texture(0.1));
-    material *metal_ = new metal(vec3(0.5, 0.5, 0.5), 0);
-    material *glass = new dielectric(1.8);
+// Scene Construction. The objects are wrapped in the given acceleration structure, built on threads if it is not NULL.
+// All of them are made in storage, so the scene lives as long as storage does
+scene_description scene(arena &storage, accel_type accel = default_accel, bvh_builder builder = default_bvh_builder,
+                        thread_pool *threads = NULL) {
+    int i = 0;
+    hitable **list = storage.make_array<hitable *>(25);
+    int lightCount = 0;
+    hitable **lights = storage.make_array<hitable *>(1);
+    material *rightWall = storage.make<lambertian>(storage.make<constant_texture>(rgb(0xb0, 0x7a, 0x29)));
+
+    material *ceiling = storage.make<lambertian>(storage.make<constant_texture>(rgb(0xff, 0xe8, 0xe0)));
+    material *ground = storage.make<metal>(rgb(0xff, 0xe8, 0xe0), 0.15);
+    material *backWall = storage.make<lambertian>(storage.make<constant_texture>(rgb(245, 208, 184)));
+
+    material *leftWall = storage.make<lambertian>(storage.make<constant_texture>(rgb(0x60, 0x4e, 0xc9)));
+    material *pillar = storage.make<isotropic>(storage.make<constant_texture>(rgb(128, 128, 128)));
+    material *beacon = storage.make<diffuse_light>(storage.make<constant_texture>(rgb(53, 89, 180) * 17.5));
+    material *smoke = storage.make<isotropic>(storage.make<constant_texture>(rgb(255, 255, 255)));
+    material *noise = storage.make<lambertian>(storage.make<noise_texture>(0.1));
+    material *metal_ = storage.make<metal>(vec3(0.5, 0.5, 0.5), 0);
+    material *glass = storage.make<dielectric>(1.8);
 
     //constructing the cornell box
-    list[i++] = new flip_normals(new yz_rect(-1400, 1000, -1400, 1000, 1000, leftWall)); //left wall
-    list[i++] = new yz_rect(-1400, 1000, -1400, 1000, 0, rightWall); // right wall
-    //list[i++] = new xz_rect(375, 625, 375, 625, 999, light); // ceiling light
-    list[i++] = new flip_normals(new xz_rect(-1400, 1000, -1400, 1000, 1000, ceiling)); // ceiling
-    list[i++] = new xz_rect(-1400, 1000, -1400, 1000, 0, ground); // // ground
-    list[i++] = new flip_normals(new xy_rect(0, 1000, 0, 1000, 1000, backWall)); // front wall
-    list[i++] = new xy_rect(-0, 1000, 0, 1000, -1350, backWall); // back wall (behind the camera)
+    list[i++] = storage.make<flip_normals>(storage.make<yz_rect>(-1400, 1000, -1400, 1000, 1000, leftWall)); //left wall
+    list[i++] = storage.make<yz_rect>(-1400, 1000, -1400, 1000, 0, rightWall); // right wall
+    //list[i++] = storage.make<xz_rect>(375, 625, 375, 625, 999, light); // ceiling light
+    list[i++] = storage.make<flip_normals>(storage.make<xz_rect>(-1400, 1000, -1400, 1000, 1000, ceiling)); // ceiling
+    list[i++] = storage.make<xz_rect>(-1400, 1000, -1400, 1000, 0, ground); // // ground
+    list[i++] = storage.make<flip_normals>(storage.make<xy_rect>(0, 1000, 0, 1000, 1000, backWall)); // front wall
+    list[i++] = storage.make<xy_rect>(-0, 1000, 0, 1000, -1350, backWall); // back wall (behind the camera)
     //Done construction
 
     //---- The centeral pillar
-    list[i++] = new translate(new rotate_y(new box(vec3(-150, 290, -150), vec3(150, 300, 150), glass), 45),
-                              vec3(500, 0, 500)); //top
-    list[i++] = new translate(new rotate_y(new box(vec3(-150, 0, -150), vec3(-140, 300, 150), glass), 45),
-                              vec3(500, 0, 500)); //left
-    list[i++] = new translate(new rotate_y(new box(vec3(140, 0, -150), vec3(150, 300, 150), glass), 45),
-                              vec3(500, 0, 500)); //right
-    list[i++] = new translate(new rotate_y(new box(vec3(-150, 0, 140), vec3(150, 300, 150), glass), 45),
-                              vec3(500, 0, 500)); //front
-    list[i++] = new translate(new rotate_y(new box(vec3(-150, 0, -150), vec3(150, 300, -140), glass), 45),
-                              vec3(500, 0, 500)); //back
-    list[i++] = new translate(new rotate_y(new box(vec3(-140, 0, -140), vec3(140, 290, 140), pillar), 45),
-                              vec3(500, 0, 500)); // the pillar
-
-    list[i++] = new box(vec3(425, 0, 425), vec3(575, 290, 575), beacon); // light source
-    list[i++] = new sphere(vec3(500, 290, 500), 100, glass); // center sphere
-    list[i++] = new sphere(vec3(500, 290, 500), 50, smoke); // the center sphere
+    // No two faces lie in the same place: the panes of the glass case, the pillar, the light source and the ground
+    // are kept a unit apart. Faces that coincide are hit at the same t, and the one the tree happens to test first
+    // would win, so the image would depend on the acceleration structure
+    list[i++] = storage.make<translate>(
+            storage.make<rotate_y>(storage.make<box>(vec3(-150, 291, -150), vec3(150, 300, 150), glass), 45),
+            vec3(500, 0, 500)); //top
+    list[i++] = storage.make<translate>(
+            storage.make<rotate_y>(storage.make<box>(vec3(-150, 1, -139), vec3(-140, 290, 139), glass), 45),
+            vec3(500, 0, 500)); //left
+    list[i++] = storage.make<translate>(
+            storage.make<rotate_y>(storage.make<box>(vec3(140, 1, -139), vec3(150, 290, 139), glass), 45),
+            vec3(500, 0, 500)); //right
+    list[i++] = storage.make<translate>(
+            storage.make<rotate_y>(storage.make<box>(vec3(-150, 1, 140), vec3(150, 290, 150), glass), 45),
+            vec3(500, 0, 500)); //front
+    list[i++] = storage.make<translate>(
+            storage.make<rotate_y>(storage.make<box>(vec3(-150, 1, -150), vec3(150, 290, -140), glass), 45),
+            vec3(500, 0, 500)); //back
+    list[i++] = storage.make<translate>(
+            storage.make<rotate_y>(storage.make<box>(vec3(-139, 1, -139), vec3(139, 289, 139), pillar), 45),
+            vec3(500, 0, 500)); // the pillar
+
+    list[i++] = storage.make<box>(vec3(426, 2, 426), vec3(574, 288, 574), beacon); // light source
+    lights[lightCount++] = list[i - 1];
+    list[i++] = storage.make<sphere>(vec3(500, 290, 500), 100, glass); // center sphere
+    list[i++] = storage.make<sphere>(vec3(500, 290, 500), 50, smoke); // the center sphere
     for (int j = 0; j < 5; j++) {
-        list[i++] = new sphere(vec3(500, 290, 500), 60 + j * 5, new dielectric(pow(2, j + 1)));
+        list[i++] = storage.make<sphere>(vec3(500, 290, 500), 60 + j * 5, storage.make<dielectric>(pow(2, j + 1)));
     }
     //---- Done Construction
 
 
-    list[i++] = new sphere(vec3(200, 100, 750), 100, metal_); // the metal sphere
-    list[i++] = new sphere(vec3(800, 100, 250), 100, noise); // the noise sphere
+    list[i++] = storage.make<sphere>(vec3(200, 100, 750), 100, metal_); // the metal sphere
+    list[i++] = storage.make<sphere>(vec3(800, 100, 250), 100, noise); // the noise sphere
 
-    list[i++] = new sphere(vec3(750, 750, 750), 150, glass); // the glass sphere
-    list[i++] = new sphere(vec3(250, 750, 250), 150, glass); // the glass sphere
+    list[i++] = storage.make<sphere>(vec3(750, 750, 750), 150, glass); // the glass sphere
+    list[i++] = storage.make<sphere>(vec3(250, 750, 250), 150, glass); // the glass sphere
 
 
-    return new hitable_list(list, i);
+    scene_description description;
+    // wrap the objects in a bvh so each ray only tests the objects along its way
+    description.world = build_accel(list, i, accel, 0.0, 1.0, storage, builder, &description.build, threads);
+    description.lights = lightCount > 0 ? storage.make<hitable_list>(lights, lightCount) : NULL;
+    return description;
 
 }
 
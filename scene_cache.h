@@ -0,0 +1,679 @@
+// This file contains the scene cache, a compiled scene in a binary file that is mapped into memory instead of parsed
+// Loading a big scene file is mostly parsing the text and building the bvh. The cache holds the result of both: flat
+// tables of the textures, materials and objects, and the nodes of the finished tree. Loading it maps the file, makes
+// the objects from their records, which only copies a few numbers each, and traverses the nodes right where they lie
+// in the mapping, so the tree is never built or copied. Processes rendering the same scene on one machine share the
+// pages of the mapped file
+// A cache is made for one scene file, one acceleration structure and one bvh builder. It records a hash of the bytes
+// of the scene file and is not used once the file changed, or when it was written by a build with a different layout
+// of the records
+
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "scene.h"
+#include "instance.h"
+
+// bumped whenever the layout of the file changes, or the trees it holds may be ones the traversal cannot take.
+// Version 2: trees are kept shallower than linear_bvh_stack_size. Version 3: the builder of the tree is recorded
+const uint32_t scene_cache_version = 3;
+
+// the kinds of the records of the object table
+enum cache_shape_kind {
+    SHAPE_SPHERE,       // center, radius
+    SHAPE_XY_RECT,      // x0, x1, y0, y1, k
+    SHAPE_XZ_RECT,      // x0, x1, z0, z1, k
+    SHAPE_YZ_RECT,      // y0, y1, z0, z1, k
+    SHAPE_BOX,          // min, max
+    SHAPE_FLIP,         // the child with its normals flipped
+    SHAPE_TRANSLATE,    // the child moved by an offset
+    SHAPE_ROTATE_Y,     // the child turned by an angle in degrees
+    SHAPE_INSTANCE      // the child placed by the 3x4 matrix of instance::to_world
+};
+
+struct cache_texture {
+    int32_t kind;       // texture_kind
+    float value[3];     // constant: the color. noise: the scale in value[0]
+};
+
+struct cache_material {
+    int32_t kind;       // material_kind
+    int32_t texture;    // index of the texture of lambertian, diffuse_light and isotropic
+    float value[4];     // metal: the color and the fuzz. dielectric: the refractive index in value[0]
+};
+
+struct cache_shape {
+    int32_t kind;       // cache_shape_kind
+    int32_t material;   // index of the material of a primitive
+    int32_t child;      // index of the object inside a modifier, always lower than the index of the modifier
+    float value[13];    // the numbers listed with the kind
+};
+
+static_assert(sizeof(cache_shape) == 64, "cache_shape must stay 64 bytes");
+
+// a table of the file: where it starts and how many records it holds
+struct cache_section {
+    uint64_t offset;
+    uint64_t count;
+};
+
+// the start of the file
+struct scene_cache_header {
+    char magic[8];              // "RTSCENE"
+    uint32_t version;           // scene_cache_version
+    uint32_t accel;             // accel_type of the tree
+    uint64_t source_hash;       // scene_source_hash() of the scene file
+    uint32_t node_size;         // bytes of a node of the tree, so a build with another layout cannot misread them
+    uint32_t builder;           // bvh_builder of the tree. Another builder may order the tests of faces in the
+                                // same place differently, and so render another image
+    // the settings of the scene file
+    int32_t nx, ny;
+    int32_t min_samples, max_samples, batch;
+    float max_relative_error;
+    int32_t max_depth, rr_depth;
+    float camera[15];           // lookfrom, lookat, vup, vfov, aperture, focus_dist, time0, time1
+    float bounds[6];            // the box around the world
+    cache_section textures;     // cache_texture
+    cache_section materials;    // cache_material
+    cache_section shapes;       // cache_shape
+    cache_section primitives;   // int32_t index of the object of every primitive of the tree, in leaf order
+    cache_section lights;       // int32_t index of every light
+    cache_section nodes;        // the nodes of the tree, node_size bytes each
+};
+
+// the sections start at multiples of this, so the nodes are aligned for the wide loads of the traversal
+const uint64_t cache_section_alignment = 64;
+
+// 64 bit FNV-1a hash of the bytes of the file at path. false if it cannot be read
+bool scene_source_hash(const char *path, uint64_t &hash) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+    std::vector<unsigned char> buffer(1 << 20);
+    hash = 14695981039346656037ULL;
+    size_t n;
+    while ((n = fread(&buffer[0], 1, buffer.size(), f)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+// bytes of a node of the tree of the given type, 0 for the trees that have no node array
+size_t cache_node_size(accel_type accel) {
+    switch (accel) {
+        case ACCEL_LINEAR_BVH:
+            return sizeof(linear_bvh_node);
+        case ACCEL_BVH4:
+            return sizeof(wide_bvh_node<4>);
+        case ACCEL_BVH8:
+            return sizeof(wide_bvh_node<8>);
+        default:
+            return 0;
+    }
+}
+
+// turns the objects of a scene into the tables of a cache. Every object, material and texture gets one record, no
+// matter how many others point to it
+class scene_cache_writer {
+public:
+    // the index of the record of h, made after those of everything it points to. -1 if the cache cannot hold it
+    int shape(const hitable *h);
+
+    int material_index(const material *m);
+
+    int texture_index(const texture *t);
+
+    std::vector<cache_texture> textures;
+    std::vector<cache_material> materials;
+    std::vector<cache_shape> shapes;
+
+private:
+    // a record for h whose child is already written. The numbers are left for the caller
+    int add_shape(const hitable *h, int kind, int material, int child);
+
+    std::unordered_map<const hitable *, int> shape_indices;
+    std::unordered_map<const material *, int> material_indices;
+    std::unordered_map<const texture *, int> texture_indices;
+};
+
+int scene_cache_writer::texture_index(const texture *t) {
+    std::unordered_map<const texture *, int>::const_iterator found = texture_indices.find(t);
+    if (found != texture_indices.end())
+        return found->second;
+    cache_texture record;
+    memset(&record, 0, sizeof(record));
+    record.kind = t->kind;
+    if (t->kind == TEXTURE_CONSTANT) {
+        vec3 color = static_cast<const constant_texture *>(t)->color;
+        for (int c = 0; c < 3; c++)
+            record.value[c] = color[c];
+    } else if (t->kind == TEXTURE_NOISE)
+        record.value[0] = static_cast<const noise_texture *>(t)->scale;
+    else
+        return -1;
+    textures.push_back(record);
+    return texture_indices[t] = int(textures.size()) - 1;
+}
+
+int scene_cache_writer::material_index(const material *m) {
+    std::unordered_map<const material *, int>::const_iterator found = material_indices.find(m);
+    if (found != material_indices.end())
+        return found->second;
+    cache_material record;
+    memset(&record, 0, sizeof(record));
+    record.kind = m->kind;
+    record.texture = -1;
+    switch (m->kind) {
+        case MATERIAL_LAMBERTIAN:
+            record.texture = texture_index(static_cast<const lambertian *>(m)->albedo);
+            break;
+        case MATERIAL_METAL: {
+            const metal *mt = static_cast<const metal *>(m);
+            for (int c = 0; c < 3; c++)
+                record.value[c] = mt->albedo[c];
+            record.value[3] = mt->fuzz;
+            break;
+        }
+        case MATERIAL_DIELECTRIC:
+            record.value[0] = static_cast<const dielectric *>(m)->ref_idx;
+            break;
+        case MATERIAL_DIFFUSE_LIGHT:
+            record.texture = texture_index(static_cast<const diffuse_light *>(m)->emit);
+            break;
+        case MATERIAL_ISOTROPIC:
+            record.texture = texture_index(static_cast<const isotropic *>(m)->albedo);
+            break;
+        default:
+            return -1;
+    }
+    bool textured = m->kind == MATERIAL_LAMBERTIAN || m->kind == MATERIAL_DIFFUSE_LIGHT ||
+                    m->kind == MATERIAL_ISOTROPIC;
+    if (textured && record.texture < 0)
+        return -1;
+    materials.push_back(record);
+    return material_indices[m] = int(materials.size()) - 1;
+}
+
+int scene_cache_writer::add_shape(const hitable *h, int kind, int material, int child) {
+    cache_shape record;
+    memset(&record, 0, sizeof(record));
+    record.kind = kind;
+    record.material = material;
+    record.child = child;
+    shapes.push_back(record);
+    return shape_indices[h] = int(shapes.size()) - 1;
+}
+
+int scene_cache_writer::shape(const hitable *h) {
+    std::unordered_map<const hitable *, int>::const_iterator found = shape_indices.find(h);
+    if (found != shape_indices.end())
+        return found->second;
+    int index;
+    if (const sphere *s = dynamic_cast<const sphere *>(h)) {
+        int m = material_index(s->mat_ptr);
+        if (m < 0)
+            return -1;
+        index = add_shape(h, SHAPE_SPHERE, m, -1);
+        for (int c = 0; c < 3; c++)
+            shapes[index].value[c] = s->center[c];
+        shapes[index].value[3] = s->radius;
+    } else if (const xy_rect *r = dynamic_cast<const xy_rect *>(h)) {
+        int m = material_index(r->mp);
+        if (m < 0)
+            return -1;
+        index = add_shape(h, SHAPE_XY_RECT, m, -1);
+        float v[5] = {r->x0, r->x1, r->y0, r->y1, r->k};
+        memcpy(shapes[index].value, v, sizeof(v));
+    } else if (const xz_rect *r = dynamic_cast<const xz_rect *>(h)) {
+        int m = material_index(r->mp);
+        if (m < 0)
+            return -1;
+        index = add_shape(h, SHAPE_XZ_RECT, m, -1);
+        float v[5] = {r->x0, r->x1, r->z0, r->z1, r->k};
+        memcpy(shapes[index].value, v, sizeof(v));
+    } else if (const yz_rect *r = dynamic_cast<const yz_rect *>(h)) {
+        int m = material_index(r->mp);
+        if (m < 0)
+            return -1;
+        index = add_shape(h, SHAPE_YZ_RECT, m, -1);
+        float v[5] = {r->y0, r->y1, r->z0, r->z1, r->k};
+        memcpy(shapes[index].value, v, sizeof(v));
+    } else if (const box *b = dynamic_cast<const box *>(h)) {
+        int m = material_index(b->mp);
+        if (m < 0)
+            return -1;
+        index = add_shape(h, SHAPE_BOX, m, -1);
+        for (int c = 0; c < 3; c++) {
+            shapes[index].value[c] = b->pmin[c];
+            shapes[index].value[c + 3] = b->pmax[c];
+        }
+    } else if (const flip_normals *f = dynamic_cast<const flip_normals *>(h)) {
+        int child = shape(f->ptr);
+        if (child < 0)
+            return -1;
+        index = add_shape(h, SHAPE_FLIP, -1, child);
+    } else if (const translate *t = dynamic_cast<const translate *>(h)) {
+        int child = shape(t->ptr);
+        if (child < 0)
+            return -1;
+        index = add_shape(h, SHAPE_TRANSLATE, -1, child);
+        for (int c = 0; c < 3; c++)
+            shapes[index].value[c] = t->offset[c];
+    } else if (const rotate_y *r = dynamic_cast<const rotate_y *>(h)) {
+        int child = shape(r->ptr);
+        if (child < 0)
+            return -1;
+        index = add_shape(h, SHAPE_ROTATE_Y, -1, child);
+        shapes[index].value[0] = r->angle;
+    } else if (const instance *i = dynamic_cast<const instance *>(h)) {
+        int child = shape(i->ptr);
+        if (child < 0)
+            return -1;
+        index = add_shape(h, SHAPE_INSTANCE, -1, child);
+        memcpy(shapes[index].value, i->to_world.m, sizeof(i->to_world.m));
+    } else
+        return -1;
+    return index;
+}
+
+// write count records of size bytes at the next multiple of cache_section_alignment after offset, and move offset
+// past them
+bool cache_write_section(FILE *f, const void *records, size_t count, size_t size, uint64_t &offset,
+                         cache_section &section) {
+    static const char zeros[cache_section_alignment] = {0};
+    uint64_t start = (offset + cache_section_alignment - 1) / cache_section_alignment * cache_section_alignment;
+    if (start > offset && fwrite(zeros, 1, start - offset, f) != start - offset)
+        return false;
+    section.offset = start;
+    section.count = count;
+    offset = start + count * size;
+    return count == 0 || fwrite(records, size, count, f) == count;
+}
+
+// Compile the scene in description, whose objects are wrapped in the given acceleration structure built with builder,
+// into a cache at path. source_hash is the hash of the scene file it was loaded from. The file is written next to
+// path and renamed when complete, so a process mapping the cache at the same time never sees half of it. false, after
+// printing why, if the scene has objects or a tree the cache cannot hold or the file cannot be written
+bool write_scene_cache(const char *path, uint64_t source_hash, accel_type accel, bvh_builder builder,
+                       const scene_settings &settings, const scene_description &description) {
+    // the primitives of the tree in leaf order, and its nodes
+    const hitable *const *primitives;
+    size_t primitive_count;
+    const void *nodes = NULL;
+    size_t node_count = 0;
+    if (const linear_bvh *t = dynamic_cast<const linear_bvh *>(description.world)) {
+        primitives = t->primitives.empty() ? NULL : &t->primitives[0];
+        primitive_count = t->primitives.size();
+        nodes = t->node_array;
+        node_count = t->node_count;
+    } else if (const wide_bvh<4> *t = dynamic_cast<const wide_bvh<4> *>(description.world)) {
+        primitives = t->primitives.empty() ? NULL : &t->primitives[0];
+        primitive_count = t->primitives.size();
+        nodes = t->node_array;
+        node_count = t->node_count;
+    } else if (const wide_bvh<8> *t = dynamic_cast<const wide_bvh<8> *>(description.world)) {
+        primitives = t->primitives.empty() ? NULL : &t->primitives[0];
+        primitive_count = t->primitives.size();
+        nodes = t->node_array;
+        node_count = t->node_count;
+    } else if (const hitable_list *t = dynamic_cast<const hitable_list *>(description.world)) {
+        primitives = t->list;
+        primitive_count = t->list_size;
+    } else {
+        fprintf(stderr, "%s: only scenes in a list, linear, bvh4 or bvh8 can be cached\n", path);
+        return false;
+    }
+
+    scene_cache_writer writer;
+    std::vector<int32_t> primitive_indices(primitive_count);
+    for (size_t i = 0; i < primitive_count; i++) {
+        primitive_indices[i] = writer.shape(primitives[i]);
+        if (primitive_indices[i] < 0) {
+            fprintf(stderr, "%s: the scene holds an object the cache cannot store\n", path);
+            return false;
+        }
+    }
+    std::vector<int32_t> light_indices;
+    if (description.lights != NULL) {
+        const hitable_list *lights = dynamic_cast<const hitable_list *>(description.lights);
+        for (int i = 0; lights != NULL && i < lights->list_size; i++)
+            light_indices.push_back(writer.shape(lights->list[i]));
+        if (lights == NULL || std::find(light_indices.begin(), light_indices.end(), -1) != light_indices.end()) {
+            fprintf(stderr, "%s: the scene holds a light the cache cannot store\n", path);
+            return false;
+        }
+    }
+
+    scene_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "RTSCENE", 8);
+    header.version = scene_cache_version;
+    header.accel = accel;
+    header.source_hash = source_hash;
+    header.node_size = uint32_t(cache_node_size(accel));
+    header.builder = builder;
+    header.nx = settings.nx;
+    header.ny = settings.ny;
+    header.min_samples = settings.adaptive.min_samples;
+    header.max_samples = settings.adaptive.max_samples;
+    header.batch = settings.adaptive.batch;
+    header.max_relative_error = settings.adaptive.max_relative_error;
+    header.max_depth = settings.paths.max_depth;
+    header.rr_depth = settings.paths.rr_depth;
+    const camera_settings &v = settings.view;
+    float view[15] = {v.lookfrom[0], v.lookfrom[1], v.lookfrom[2], v.lookat[0], v.lookat[1], v.lookat[2],
+                      v.vup[0], v.vup[1], v.vup[2], v.vfov, v.aperture, v.focus_dist, v.time0, v.time1, 0};
+    memcpy(header.camera, view, sizeof(view));
+    aabb bounds;
+    if (description.world->bounding_box(v.time0, v.time1, bounds)) {
+        for (int c = 0; c < 3; c++) {
+            header.bounds[c] = bounds.min()[c];
+            header.bounds[c + 3] = bounds.max()[c];
+        }
+    }
+
+    std::string temporary = std::string(path) + ".tmp";
+    FILE *f = fopen(temporary.c_str(), "wb");
+    if (f == NULL) {
+        fprintf(stderr, "cannot write scene cache %s\n", temporary.c_str());
+        return false;
+    }
+    // the header is written again once the sections are placed
+    uint64_t offset = sizeof(header);
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              cache_write_section(f, writer.textures.empty() ? NULL : &writer.textures[0], writer.textures.size(),
+                                  sizeof(cache_texture), offset, header.textures) &&
+              cache_write_section(f, writer.materials.empty() ? NULL : &writer.materials[0], writer.materials.size(),
+                                  sizeof(cache_material), offset, header.materials) &&
+              cache_write_section(f, writer.shapes.empty() ? NULL : &writer.shapes[0], writer.shapes.size(),
+                                  sizeof(cache_shape), offset, header.shapes) &&
+              cache_write_section(f, primitive_indices.empty() ? NULL : &primitive_indices[0],
+                                  primitive_indices.size(), sizeof(int32_t), offset, header.primitives) &&
+              cache_write_section(f, light_indices.empty() ? NULL : &light_indices[0], light_indices.size(),
+                                  sizeof(int32_t), offset, header.lights) &&
+              cache_write_section(f, nodes, node_count, header.node_size, offset, header.nodes) &&
+              fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path) != 0) {
+        fprintf(stderr, "cannot write scene cache %s\n", path);
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// a file mapped read only into memory, unmapped when destroyed. A scene loaded from a cache keeps it in its arena,
+// because its trees point into it
+class mapped_file {
+public:
+    mapped_file() : address(NULL), size(0) {}
+
+    ~mapped_file() {
+        if (address != NULL)
+            munmap(address, size);
+    }
+
+    // map the file at path. false if it cannot be opened
+    bool map(const char *path);
+
+    void swap(mapped_file &other) {
+        std::swap(address, other.address);
+        std::swap(size, other.size);
+    }
+
+    const char *data() const { return static_cast<const char *>(address); }
+
+    void *address;
+    size_t size;
+
+private:
+    mapped_file(const mapped_file &);
+
+    mapped_file &operator=(const mapped_file &);
+};
+
+bool mapped_file::map(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping stays valid without the descriptor
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+    address = mapping;
+    size = size_t(info.st_size);
+    return true;
+}
+
+// whether a section of count records of size bytes lies inside a file of file_size bytes
+inline bool cache_section_fits(const cache_section &section, size_t size, size_t file_size) {
+    return section.offset % sizeof(int32_t) == 0 && section.offset <= file_size &&
+           section.count <= (file_size - section.offset) / (size == 0 ? 1 : size);
+}
+
+// Load the scene compiled into the cache at path by write_scene_cache(). The objects are made in storage, which
+// also keeps the mapping of the file, and the settings of the scene file replace those in settings. false when there
+// is no cache at path, or it was made from another version of the scene file, for another acceleration structure or
+// bvh builder or by another build, which are printed. The scene has to be loaded from its file then
+bool load_scene_cache(const char *path, uint64_t source_hash, accel_type accel, bvh_builder builder, arena &storage,
+                      scene_settings &settings, scene_description &description) {
+    mapped_file file;
+    if (!file.map(path))
+        return false;
+    const scene_cache_header &header = *reinterpret_cast<const scene_cache_header *>(file.data());
+    if (file.size < sizeof(header) || memcmp(header.magic, "RTSCENE", 8) != 0 ||
+        header.version != scene_cache_version) {
+        printf("%s was written by another version of the renderer\n", path);
+        return false;
+    }
+    if (header.accel != uint32_t(accel)) {
+        printf("%s holds another acceleration structure\n", path);
+        return false;
+    }
+    if (header.builder != uint32_t(builder)) {
+        printf("%s holds a tree of another bvh builder\n", path);
+        return false;
+    }
+    if (header.node_size != cache_node_size(accel)) {
+        printf("%s was written by another build of the renderer\n", path);
+        return false;
+    }
+    if (header.source_hash != source_hash) {
+        printf("%s is out of date\n", path);
+        return false;
+    }
+    if (!cache_section_fits(header.textures, sizeof(cache_texture), file.size) ||
+        !cache_section_fits(header.materials, sizeof(cache_material), file.size) ||
+        !cache_section_fits(header.shapes, sizeof(cache_shape), file.size) ||
+        !cache_section_fits(header.primitives, sizeof(int32_t), file.size) ||
+        !cache_section_fits(header.lights, sizeof(int32_t), file.size) ||
+        !cache_section_fits(header.nodes, header.node_size, file.size)) {
+        fprintf(stderr, "%s: broken scene cache\n", path);
+        return false;
+    }
+
+    const cache_texture *texture_records = reinterpret_cast<const cache_texture *>(file.data() +
+                                                                                   header.textures.offset);
+    std::vector<texture *> textures(header.textures.count);
+    for (size_t i = 0; i < textures.size(); i++) {
+        const float *v = texture_records[i].value;
+        if (texture_records[i].kind == TEXTURE_CONSTANT)
+            textures[i] = storage.make<constant_texture>(vec3(v[0], v[1], v[2]));
+        else if (texture_records[i].kind == TEXTURE_NOISE)
+            textures[i] = storage.make<noise_texture>(v[0]);
+        else {
+            fprintf(stderr, "%s: broken scene cache\n", path);
+            return false;
+        }
+    }
+
+    const cache_material *material_records = reinterpret_cast<const cache_material *>(file.data() +
+                                                                                      header.materials.offset);
+    std::vector<material *> materials(header.materials.count);
+    for (size_t i = 0; i < materials.size(); i++) {
+        const cache_material &record = material_records[i];
+        const float *v = record.value;
+        texture *tex = record.texture >= 0 && size_t(record.texture) < textures.size() ? textures[record.texture]
+                                                                                       : NULL;
+        if (record.kind == MATERIAL_METAL)
+            materials[i] = storage.make<metal>(vec3(v[0], v[1], v[2]), v[3]);
+        else if (record.kind == MATERIAL_DIELECTRIC)
+            materials[i] = storage.make<dielectric>(v[0]);
+        else if (tex != NULL && record.kind == MATERIAL_LAMBERTIAN)
+            materials[i] = storage.make<lambertian>(tex);
+        else if (tex != NULL && record.kind == MATERIAL_DIFFUSE_LIGHT)
+            materials[i] = storage.make<diffuse_light>(tex);
+        else if (tex != NULL && record.kind == MATERIAL_ISOTROPIC)
+            materials[i] = storage.make<isotropic>(tex);
+        else {
+            fprintf(stderr, "%s: broken scene cache\n", path);
+            return false;
+        }
+    }
+
+    const cache_shape *shape_records = reinterpret_cast<const cache_shape *>(file.data() + header.shapes.offset);
+    std::vector<hitable *> shapes(header.shapes.count);
+    for (size_t i = 0; i < shapes.size(); i++) {
+        const cache_shape &record = shape_records[i];
+        const float *v = record.value;
+        material *mat = record.material >= 0 && size_t(record.material) < materials.size()
+                        ? materials[record.material] : NULL;
+        hitable *child = record.child >= 0 && size_t(record.child) < i ? shapes[record.child] : NULL;
+        hitable *h = NULL;
+        switch (mat != NULL ? record.kind : -1) {
+            case SHAPE_SPHERE:
+                h = storage.make<sphere>(vec3(v[0], v[1], v[2]), v[3], mat);
+                break;
+            case SHAPE_XY_RECT:
+                h = storage.make<xy_rect>(v[0], v[1], v[2], v[3], v[4], mat);
+                break;
+            case SHAPE_XZ_RECT:
+                h = storage.make<xz_rect>(v[0], v[1], v[2], v[3], v[4], mat);
+                break;
+            case SHAPE_YZ_RECT:
+                h = storage.make<yz_rect>(v[0], v[1], v[2], v[3], v[4], mat);
+                break;
+            case SHAPE_BOX:
+                h = storage.make<box>(vec3(v[0], v[1], v[2]), vec3(v[3], v[4], v[5]), mat);
+                break;
+        }
+        switch (child != NULL ? record.kind : -1) {
+            case SHAPE_FLIP:
+                h = storage.make<flip_normals>(child);
+                break;
+            case SHAPE_TRANSLATE:
+                h = storage.make<translate>(child, vec3(v[0], v[1], v[2]));
+                break;
+            case SHAPE_ROTATE_Y:
+                h = storage.make<rotate_y>(child, v[0]);
+                break;
+            case SHAPE_INSTANCE: {
+                transform to_world;
+                memcpy(to_world.m, v, sizeof(to_world.m));
+                h = storage.make<instance>(child, to_world);
+                break;
+            }
+        }
+        if (h == NULL) {
+            fprintf(stderr, "%s: broken scene cache\n", path);
+            return false;
+        }
+        shapes[i] = h;
+    }
+
+    // the objects of a section of indices into the object table, in an array in storage
+    const cache_section *sections[2] = {&header.primitives, &header.lights};
+    hitable **lists[2];
+    for (int s = 0; s < 2; s++) {
+        const int32_t *indices = reinterpret_cast<const int32_t *>(file.data() + sections[s]->offset);
+        lists[s] = storage.make_array<hitable *>(sections[s]->count);
+        for (size_t i = 0; i < sections[s]->count; i++) {
+            if (indices[i] < 0 || size_t(indices[i]) >= shapes.size()) {
+                fprintf(stderr, "%s: broken scene cache\n", path);
+                return false;
+            }
+            lists[s][i] = shapes[indices[i]];
+        }
+    }
+
+    // the trees traverse the nodes in the mapping, which from now on lives in storage
+    mapped_file *kept = storage.make<mapped_file>();
+    kept->swap(file);
+    const char *nodes = kept->data() + header.nodes.offset;
+    int node_count = int(header.nodes.count);
+    int primitive_count = int(header.primitives.count);
+    aabb bounds(vec3(header.bounds[0], header.bounds[1], header.bounds[2]),
+                vec3(header.bounds[3], header.bounds[4], header.bounds[5]));
+    switch (accel) {
+        case ACCEL_LINEAR_BVH: {
+            linear_bvh *tree = storage.make<linear_bvh>(reinterpret_cast<const linear_bvh_node *>(nodes),
+                                                        node_count, lists[0], primitive_count);
+            storage.add_external(tree->memory());
+            description.world = tree;
+            break;
+        }
+        case ACCEL_BVH4: {
+            wide_bvh<4> *tree = storage.make<wide_bvh<4> >(reinterpret_cast<const wide_bvh_node<4> *>(nodes),
+                                                           node_count, lists[0], primitive_count, bounds);
+            storage.add_external(tree->memory());
+            description.world = tree;
+            break;
+        }
+        case ACCEL_BVH8: {
+            wide_bvh<8> *tree = storage.make<wide_bvh<8> >(reinterpret_cast<const wide_bvh_node<8> *>(nodes),
+                                                           node_count, lists[0], primitive_count, bounds);
+            storage.add_external(tree->memory());
+            description.world = tree;
+            break;
+        }
+        default:
+            description.world = storage.make<hitable_list>(lists[0], primitive_count);
+    }
+    int light_count = int(header.lights.count);
+    description.lights = light_count > 0 ? storage.make<hitable_list>(lists[1], light_count) : NULL;
+
+    settings.nx = header.nx;
+    settings.ny = header.ny;
+    settings.adaptive.min_samples = header.min_samples;
+    settings.adaptive.max_samples = header.max_samples;
+    settings.adaptive.batch = header.batch;
+    settings.adaptive.max_relative_error = header.max_relative_error;
+    settings.paths.max_depth = header.max_depth;
+    settings.paths.rr_depth = header.rr_depth;
+    const float *c = header.camera;
+    camera_settings &v = settings.view;
+    v.lookfrom = vec3(c[0], c[1], c[2]);
+    v.lookat = vec3(c[3], c[4], c[5]);
+    v.vup = vec3(c[6], c[7], c[8]);
+    v.vfov = c[9];
+    v.aperture = c[10];
+    v.focus_dist = c[11];
+    v.time0 = c[12];
+    v.time1 = c[13];
+    return true;
+}
+
+#endif //SCENE_CACHE_H
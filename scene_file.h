@@ -0,0 +1,410 @@
+// This file contains the loader of scene files, text files that describe a scene instead of compiling it into scene.h
+// A scene file is read one statement per line. A line holds a keyword and its arguments separated by blanks, and
+// everything after a # is a comment. The file is read through a large buffer and parsed as it streams in, the
+// objects are made in the arena right away and nothing of the text is kept, so a file with millions of primitives
+// loads about as fast as it can be read
+//
+// Render settings, each optional, the built-in values are used for anything not given:
+//     resolution NX NY
+//     samples MIN MAX                          samples per pixel, see adaptive.h
+//     error E                                  relative error at which a pixel stops
+//     depth MAX RR                             bounces at most and before Russian roulette
+//     camera FROM AT UP VFOV APERTURE FOCUS [T0 T1]
+// Textures and materials are named, and have to be defined before they are used:
+//     texture NAME constant COLOR | noise SCALE
+//     material NAME lambertian TEX | metal COLOR FUZZ | dielectric IOR | light TEX | isotropic TEX
+// Objects. Any number of modifiers may come before an object, the first one is applied last:
+//     sphere CENTER RADIUS MAT
+//     xy_rect X0 X1 Y0 Y1 Z MAT,  xz_rect X0 X1 Z0 Z1 Y MAT,  yz_rect Y0 Y1 Z0 Z1 X MAT
+//     box MIN MAX MAT
+//     mesh FILE MAT                            an OBJ or binary PLY file, relative to the scene file, see mesh.h
+//     flip | translate OFFSET | rotate_y DEGREES
+// FROM, AT, UP, CENTER, MIN, MAX and OFFSET are three numbers. A COLOR is three numbers between 0 and 1, or between
+// 0 and 255 when preceded by rgb, and may be followed by scale S. A TEX is the name of a texture, or constant COLOR or
+// noise SCALE for a texture of its own. Objects with a light material are sampled directly by the integrator, except
+// meshes, which only emit where paths hit them
+
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "scene.h"
+#include "tokenizer.h"
+#include "mesh.h"
+
+// turns the statements of a scene file into objects in an arena
+class scene_parser {
+public:
+    scene_parser(FILE *f, const char *p, arena &a, bvh_builder b, thread_pool *t, scene_settings &s)
+            : in(f), path(p), storage(a), builder(b), threads(t), settings(s), sampleable(true) {}
+
+    // read every statement of the file. false, after printing where and why, if the file is not a valid scene
+    bool parse();
+
+    std::vector<hitable *> objects;
+    std::vector<hitable *> lights;  // the objects with a light material
+
+private:
+    bool statement(const char *keyword);
+
+    bool object(hitable *&result, material *&mat);
+
+    bool texture_reference(texture *&result);
+
+    bool material_definition(material *&result);
+
+    bool number(float &value, const char *what);
+
+    bool integer(int &value, const char *what);
+
+    bool vector(vec3 &value, const char *what);
+
+    bool color(vec3 &value, const char *what);
+
+    bool name(std::string &value, const char *what);
+
+    bool error(const char *format, ...);
+
+    text_tokenizer in;
+    const char *path;
+    arena &storage;
+    bvh_builder builder;    // of the trees of meshes
+    thread_pool *threads;   // the large trees of meshes are built on, may be NULL
+    scene_settings &settings;
+    std::unordered_map<std::string, texture *> textures;
+    std::unordered_map<std::string, material *> materials;
+    std::string mesh_file;  // the file of the mesh statement being read
+    bool sampleable;        // whether the object being read can be sampled as a light
+};
+
+// print the message behind the file and line it is about
+bool scene_parser::error(const char *format, ...) {
+    fprintf(stderr, "%s:%d: ", path, in.line_number());
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    return false;
+}
+
+bool scene_parser::number(float &value, const char *what) {
+    const char *t = in.next();
+    if (t == NULL)
+        return error("missing %s", what);
+    char *end;
+    value = strtof(t, &end);
+    if (end == t || *end != '\0')
+        return error("%s is not a number: %s", what, t);
+    return true;
+}
+
+bool scene_parser::integer(int &value, const char *what) {
+    const char *t = in.next();
+    if (t == NULL)
+        return error("missing %s", what);
+    char *end;
+    value = int(strtol(t, &end, 10));
+    if (end == t || *end != '\0')
+        return error("%s is not an integer: %s", what, t);
+    return true;
+}
+
+bool scene_parser::vector(vec3 &value, const char *what) {
+    float x, y, z;
+    if (!number(x, what) || !number(y, what) || !number(z, what))
+        return false;
+    value = vec3(x, y, z);
+    return true;
+}
+
+// [rgb] R G B [scale S]
+bool scene_parser::color(vec3 &value, const char *what) {
+    const char *t = in.next();
+    bool bytes = t != NULL && strcmp(t, "rgb") == 0;
+    if (!bytes)
+        in.put_back();
+    if (!vector(value, what))
+        return false;
+    if (bytes)
+        value = rgb(value[0], value[1], value[2]);
+    t = in.next();
+    if (t != NULL && strcmp(t, "scale") == 0) {
+        float s;
+        if (!number(s, "scale"))
+            return false;
+        value = value * s;
+    } else
+        in.put_back();
+    return true;
+}
+
+bool scene_parser::name(std::string &value, const char *what) {
+    const char *t = in.next();
+    if (t == NULL)
+        return error("missing %s", what);
+    value = t;
+    return true;
+}
+
+// the name of a texture, or constant COLOR or noise SCALE
+bool scene_parser::texture_reference(texture *&result) {
+    const char *t = in.next();
+    if (t == NULL)
+        return error("missing texture");
+    if (strcmp(t, "constant") == 0) {
+        vec3 c;
+        if (!color(c, "texture color"))
+            return false;
+        result = storage.make<constant_texture>(c);
+    } else if (strcmp(t, "noise") == 0) {
+        float scale;
+        if (!number(scale, "noise scale"))
+            return false;
+        result = storage.make<noise_texture>(scale);
+    } else {
+        std::unordered_map<std::string, texture *>::const_iterator found = textures.find(t);
+        if (found == textures.end())
+            return error("unknown texture %s", t);
+        result = found->second;
+    }
+    return true;
+}
+
+// what follows the name of a material statement
+bool scene_parser::material_definition(material *&result) {
+    const char *t = in.next();
+    if (t == NULL)
+        return error("missing material type");
+    texture *tex;
+    if (strcmp(t, "lambertian") == 0) {
+        if (!texture_reference(tex))
+            return false;
+        result = storage.make<lambertian>(tex);
+    } else if (strcmp(t, "metal") == 0) {
+        vec3 albedo;
+        float fuzz;
+        if (!color(albedo, "metal color") || !number(fuzz, "fuzz"))
+            return false;
+        result = storage.make<metal>(albedo, fuzz);
+    } else if (strcmp(t, "dielectric") == 0) {
+        float ior;
+        if (!number(ior, "refractive index"))
+            return false;
+        result = storage.make<dielectric>(ior);
+    } else if (strcmp(t, "light") == 0) {
+        if (!texture_reference(tex))
+            return false;
+        result = storage.make<diffuse_light>(tex);
+    } else if (strcmp(t, "isotropic") == 0) {
+        if (!texture_reference(tex))
+            return false;
+        result = storage.make<isotropic>(tex);
+    } else
+        return error("unknown material type %s", t);
+    return true;
+}
+
+// an object and the modifiers in front of it. mat is the material of the object inside the modifiers
+bool scene_parser::object(hitable *&result, material *&mat) {
+    const char *t = in.next();
+    if (t == NULL)
+        return error("missing object");
+    if (strcmp(t, "flip") == 0) {
+        hitable *inner;
+        if (!object(inner, mat))
+            return false;
+        result = storage.make<flip_normals>(inner);
+        return true;
+    }
+    if (strcmp(t, "translate") == 0) {
+        vec3 offset;
+        hitable *inner;
+        if (!vector(offset, "offset") || !object(inner, mat))
+            return false;
+        result = storage.make<translate>(inner, offset);
+        return true;
+    }
+    if (strcmp(t, "rotate_y") == 0) {
+        float angle;
+        hitable *inner;
+        if (!number(angle, "angle") || !object(inner, mat))
+            return false;
+        result = storage.make<rotate_y>(inner, angle);
+        return true;
+    }
+
+    // the arguments of the primitives, the material comes last
+    std::string kind = t;
+    float a[6];
+    vec3 p0, p1;
+    if (kind == "sphere") {
+        if (!vector(p0, "center") || !number(a[0], "radius"))
+            return false;
+    } else if (kind == "xy_rect" || kind == "xz_rect" || kind == "yz_rect") {
+        for (int i = 0; i < 5; i++)
+            if (!number(a[i], "rectangle bound"))
+                return false;
+    } else if (kind == "box") {
+        if (!vector(p0, "box corner") || !vector(p1, "box corner"))
+            return false;
+    } else if (kind == "mesh") {
+        const char *file = in.next();
+        if (file == NULL)
+            return error("missing mesh file");
+        // relative to the directory of the scene file
+        mesh_file = file;
+        const char *slash = strrchr(path, '/');
+        if (file[0] != '/' && slash != NULL)
+            mesh_file = std::string(path, slash + 1) + mesh_file;
+    } else
+        return error("unknown statement %s", t);
+
+    const char *m = in.next();
+    if (m == NULL)
+        return error("missing material");
+    std::unordered_map<std::string, material *>::const_iterator found = materials.find(m);
+    if (found == materials.end())
+        return error("unknown material %s", m);
+    mat = found->second;
+
+    if (kind == "sphere")
+        result = storage.make<sphere>(p0, a[0], mat);
+    else if (kind == "xy_rect")
+        result = storage.make<xy_rect>(a[0], a[1], a[2], a[3], a[4], mat);
+    else if (kind == "xz_rect")
+        result = storage.make<xz_rect>(a[0], a[1], a[2], a[3], a[4], mat);
+    else if (kind == "yz_rect")
+        result = storage.make<yz_rect>(a[0], a[1], a[2], a[3], a[4], mat);
+    else if (kind == "box")
+        result = storage.make<box>(p0, p1, mat);
+    else {
+        mesh_buffers buffers;
+        if (!load_mesh(mesh_file.c_str(), buffers))
+            return error("cannot load mesh %s", mesh_file.c_str());
+        // a mesh without faces has no bounding box, the trees could not hold it
+        if (buffers.indices.empty())
+            return error("mesh %s has no triangles", mesh_file.c_str());
+        triangle_mesh *m = storage.make<triangle_mesh>(buffers, mat, builder, threads);
+        storage.add_external(m->memory());
+        result = m;
+        sampleable = false;
+    }
+    return true;
+}
+
+// one line of the file, keyword is its first token
+bool scene_parser::statement(const char *keyword) {
+    if (strcmp(keyword, "resolution") == 0) {
+        if (!integer(settings.nx, "width") || !integer(settings.ny, "height"))
+            return false;
+        if (settings.nx < 1 || settings.ny < 1)
+            return error("the resolution must be at least 1x1");
+    } else if (strcmp(keyword, "samples") == 0) {
+        if (!integer(settings.adaptive.min_samples, "minimum samples") ||
+            !integer(settings.adaptive.max_samples, "maximum samples"))
+            return false;
+    } else if (strcmp(keyword, "error") == 0) {
+        if (!number(settings.adaptive.max_relative_error, "relative error"))
+            return false;
+    } else if (strcmp(keyword, "depth") == 0) {
+        if (!integer(settings.paths.max_depth, "maximum depth") ||
+            !integer(settings.paths.rr_depth, "russian roulette depth"))
+            return false;
+    } else if (strcmp(keyword, "camera") == 0) {
+        camera_settings &v = settings.view;
+        if (!vector(v.lookfrom, "camera position") || !vector(v.lookat, "camera target") ||
+            !vector(v.vup, "camera up") || !number(v.vfov, "field of view") || !number(v.aperture, "aperture") ||
+            !number(v.focus_dist, "focus distance"))
+            return false;
+        // the shutter times are optional
+        if (in.next() != NULL) {
+            in.put_back();
+            if (!number(v.time0, "shutter open") || !number(v.time1, "shutter close"))
+                return false;
+        }
+    } else if (strcmp(keyword, "texture") == 0) {
+        std::string n;
+        texture *tex;
+        if (!name(n, "texture name") || !texture_reference(tex))
+            return false;
+        if (!textures.insert(std::make_pair(n, tex)).second)
+            return error("texture %s is defined twice", n.c_str());
+    } else if (strcmp(keyword, "material") == 0) {
+        std::string n;
+        material *mat;
+        if (!name(n, "material name") || !material_definition(mat))
+            return false;
+        if (!materials.insert(std::make_pair(n, mat)).second)
+            return error("material %s is defined twice", n.c_str());
+    } else {
+        in.put_back();
+        hitable *h;
+        material *mat;
+        sampleable = true;
+        if (!object(h, mat))
+            return false;
+        objects.push_back(h);
+        if (mat->kind == MATERIAL_DIFFUSE_LIGHT && sampleable)
+            lights.push_back(h);
+    }
+    return true;
+}
+
+bool scene_parser::parse() {
+    while (in.next_line()) {
+        if (!statement(in.next()))
+            return false;
+        const char *extra = in.next();
+        if (extra != NULL)
+            return error("unexpected %s", extra);
+    }
+    if (in.failed())
+        return error("read error");
+    return true;
+}
+
+// Load the scene file at path. The objects are made in storage and wrapped in the given acceleration structure, whose
+// tree and those of the meshes are built with builder, on threads if it is not NULL. The settings the file gives
+// replace those in settings. false, after printing why, if the file cannot be read or is not a valid scene
+bool load_scene(const char *path, arena &storage, accel_type accel, bvh_builder builder, thread_pool *threads,
+                scene_settings &settings, scene_description &description) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "cannot open scene %s\n", path);
+        return false;
+    }
+    scene_parser parser(f, path, storage, builder, threads, settings);
+    bool ok = parser.parse();
+    fclose(f);
+    if (!ok)
+        return false;
+    if (parser.objects.empty()) {
+        fprintf(stderr, "%s: the scene has no objects\n", path);
+        return false;
+    }
+
+    int count = int(parser.objects.size());
+    hitable **list = storage.make_array<hitable *>(count);
+    for (int i = 0; i < count; i++)
+        list[i] = parser.objects[i];
+    description.world = build_accel(list, count, accel, settings.view.time0, settings.view.time1, storage, builder,
+                                    &description.build, threads);
+    description.lights = NULL;
+    if (!parser.lights.empty()) {
+        int lightCount = int(parser.lights.size());
+        hitable **lights = storage.make_array<hitable *>(lightCount);
+        for (int i = 0; i < lightCount; i++)
+            lights[i] = parser.lights[i];
+        description.lights = storage.make<hitable_list>(lights, lightCount);
+    }
+    return true;
+}
+
+#endif //SCENE_FILE_H
@@ -5,6 +5,7 @@
 #define SPHERE_H
 
 #include "hitable.h"
+#include "onb.h"
 
 // the sphere class.
 class sphere : public hitable {
@@ -16,8 +17,16 @@ public:
 
     virtual bool hit(const ray &r, float tmin, float tmax, hit_record &rec) const;
 
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
+
     virtual bool bounding_box(float t0, float t1, aabb &box) const;
 
+    virtual void complete(const ray &r, hit_record &rec) const;
+
+    virtual float pdf_value(const vec3 &o, const vec3 &v) const;
+
+    virtual vec3 random(const vec3 &o, sampler &rng) const;
+
     vec3 center;
     float radius;
     material *mat_ptr;
@@ -26,35 +35,84 @@ public:
 
 // compute whether a ray hit the sphere or not
 // refer to documentation for mathematics details
+// The discriminant b^2 - ac loses all its digits when the sphere is small next to its distance from the origin, and
+// -b + sqrt(discriminant) when the ray starts on the surface, which made rays leaving a sphere hit it again. Both are
+// computed without that cancellation, as in *Precision Improvements for Ray / Sphere Intersection* by Haines et al.
 bool sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
     vec3 oc = r.origin() - center;
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
     float c = dot(oc, oc) - radius * radius;
-    float discriminant = b * b - a * c;
+    // l goes from the center to the point of the line closest to it
+    vec3 l = oc - (b / a) * r.direction();
+    float discriminant = a * (radius * radius - dot(l, l));
     if (discriminant > 0) {
-        float temp = (-b - sqrt(discriminant)) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
-        temp = (-b + sqrt(discriminant)) / a;
+        float q = b >= 0 ? -b - sqrt(discriminant) : -b + sqrt(discriminant);
+        float t0 = q / a;
+        float t1 = c / q;
+        float temp = t0 < t1 ? t0 : t1;
+        if (!(temp < t_max && temp > t_min))
+            temp = t0 < t1 ? t1 : t0;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.object = this;
             return true;
         }
     }
     return false;
 }
 
+// the point, normal and uv of a hit, only computed for the closest one
+void sphere::complete(const ray &r, hit_record &rec) const {
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = (rec.p - center) / radius;
+    get_sphere_uv(rec.normal, rec.u, rec.v);
+    rec.mat_ptr = mat_ptr;
+}
+
+// hit() for all lanes of a packet at once. The roots are found in one branch free loop over the lanes, the records
+// are only set for the lanes that hit
+int sphere::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    float t[packet_size];
+    int hit[packet_size];
+    for (int l = 0; l < packet_size; l++) {
+        float ocx = p.origin[0][l] - center[0];
+        float ocy = p.origin[1][l] - center[1];
+        float ocz = p.origin[2][l] - center[2];
+        float dx = p.direction[0][l];
+        float dy = p.direction[1][l];
+        float dz = p.direction[2][l];
+        float a = dx * dx + dy * dy + dz * dz;
+        float b = ocx * dx + ocy * dy + ocz * dz;
+        float c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+        float s = b / a;
+        float lx = ocx - s * dx;
+        float ly = ocy - s * dy;
+        float lz = ocz - s * dz;
+        float discriminant = a * (radius * radius - (lx * lx + ly * ly + lz * lz));
+        float root = sqrt(discriminant > 0 ? discriminant : 0);
+        float q = b >= 0 ? -b - root : -b + root;
+        float t0 = q / a;
+        float t1 = c / q;
+        float near = t0 < t1 ? t0 : t1;
+        float far = t0 < t1 ? t1 : t0;
+        // bitwise instead of logical operators, so the loop has no branches
+        int near_hit = (near < h.t[l]) & (near > t_min);
+        int far_hit = (far < h.t[l]) & (far > t_min);
+        t[l] = near_hit ? near : far;
+        hit[l] = (discriminant > 0) & (near_hit | far_hit);
+    }
+    int result = packet_mask(hit, mask);
+    for (int l = 0; l < packet_size; l++) {
+        if (!(result & (1 << l)))
+            continue;
+        h.rec[l].t = t[l];
+        h.rec[l].object = this;
+        h.t[l] = t[l];
+    }
+    return result;
+}
+
 // compute the bounding box for the sphere
 bool sphere::bounding_box(float t0, float t1, aabb &box) const {
     box = aabb(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius));
@@ -62,4 +120,35 @@ bool sphere::bounding_box(float t0, float t1, aabb &box) const {
 }
 
 
+// density of sphere::random picking direction v from o
+// outside the sphere the directions are uniform within the cone the sphere covers, inside they are uniform
+float sphere::pdf_value(const vec3 &o, const vec3 &v) const {
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, MAXFLOAT, rec))
+        return 0;
+    float distance_squared = dot(center - o, center - o);
+    if (distance_squared <= radius * radius)
+        return 1 / (4 * M_PI);
+    float cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    return 1 / (2 * M_PI * (1 - cos_theta_max));
+}
+
+// a random direction from o towards the sphere
+vec3 sphere::random(const vec3 &o, sampler &rng) const {
+    vec3 direction = center - o;
+    float distance_squared = dot(direction, direction);
+    float r1 = rng.next();
+    float r2 = rng.next();
+    float phi = 2 * M_PI * r1;
+    if (distance_squared <= radius * radius) {
+        float z = 1 - 2 * r2;
+        float r = sqrt(1 - z * z);
+        return vec3(cos(phi) * r, sin(phi) * r, z);
+    }
+    float cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    float z = 1 + r2 * (cos_theta_max - 1);
+    float r = sqrt(1 - z * z);
+    return onb(direction).local(cos(phi) * r, sin(phi) * r, z);
+}
+
 #endif //SPHERE_H
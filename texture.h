@@ -7,18 +7,29 @@
 #include "vec3.h"
 #include "perlin.h"
 
+// the built-in textures, so hot loops can look them up without a virtual call
+enum texture_kind {
+    TEXTURE_CONSTANT,
+    TEXTURE_NOISE,
+    TEXTURE_OTHER
+};
+
 // texture base class
 class texture {
 public:
+    texture(texture_kind k = TEXTURE_OTHER) : kind(k) {}
+
     virtual vec3 value(float u, float v, const vec3 &p) const = 0;
+
+    texture_kind kind;
 };
 
 // constant texture. Just solid color block
 class constant_texture : public texture {
 public:
-    constant_texture() {}
+    constant_texture() : texture(TEXTURE_CONSTANT) {}
 
-    constant_texture(vec3 c) : color(c) {}
+    constant_texture(vec3 c) : texture(TEXTURE_CONSTANT), color(c) {}
 
     virtual vec3 value(float u, float v, const vec3 &p) const {
         return color;
@@ -32,9 +43,9 @@ public:
 // Refer to documentation for technical details
 class noise_texture : public texture {
 public:
-    noise_texture() {}
+    noise_texture() : texture(TEXTURE_NOISE) {}
 
-    noise_texture(float sc) : scale(sc) {}
+    noise_texture(float sc) : texture(TEXTURE_NOISE), scale(sc) {}
 
     virtual vec3 value(float u, float v, const vec3 &p) const {
         // add disturbance and scaling
@@ -46,4 +57,16 @@ public:
 };
 
 
+// the value of a texture, without a virtual call for the built-in kinds
+inline vec3 texture_value(const texture *t, float u, float v, const vec3 &p) {
+    switch (t->kind) {
+        case TEXTURE_CONSTANT:
+            return static_cast<const constant_texture *>(t)->color;
+        case TEXTURE_NOISE:
+            return static_cast<const noise_texture *>(t)->noise_texture::value(u, v, p);
+        default:
+            return t->value(u, v, p);
+    }
+}
+
 #endif //TEXTURE_H
@@ -0,0 +1,155 @@
+// This file contains the work-stealing thread pool the renderer runs on
+// Every worker owns a deque of tasks. A worker takes its newest task from the back of its own deque and, once
+// that is empty, steals the oldest task from the front of another worker's deque. Tasks that take very different
+// amounts of time therefore keep every core busy until the last one is done
+// Refer to the documentation for technical details
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+class thread_pool {
+public:
+    // constructor. threads < 1 uses one thread per hardware thread
+    thread_pool(int threads = 0);
+
+    ~thread_pool();
+
+    // queue a task. Called from a worker it goes to that worker's own deque
+    void submit(const std::function<void()> &task);
+
+    // block until every submitted task has finished
+    void wait();
+
+    // number of worker threads
+    int size() const { return queues.size(); }
+
+    // index of the worker running the calling thread, -1 outside of the pool
+    static int worker_index() { return current_worker(); }
+
+private:
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    void run(int index);
+
+    bool take(int index, std::function<void()> &task);
+
+    static int &current_worker() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    std::vector<worker_queue *> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> pending;       // tasks submitted but not finished
+    std::atomic<int> queued;        // tasks waiting in a deque
+    std::atomic<int> next_queue;    // round robin target of tasks submitted from outside
+    bool stopping;
+    std::mutex sleep_lock;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+};
+
+thread_pool::thread_pool(int threads) : pending(0), queued(0), next_queue(0), stopping(false) {
+    if (threads < 1)
+        threads = std::thread::hardware_concurrency();
+    if (threads < 1)
+        threads = 1;
+    for (int i = 0; i < threads; i++)
+        queues.push_back(new worker_queue());
+    for (int i = 0; i < threads; i++)
+        this->threads.push_back(std::thread(&thread_pool::run, this, i));
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    for (size_t i = 0; i < queues.size(); i++)
+        delete queues[i];
+}
+
+void thread_pool::submit(const std::function<void()> &task) {
+    int index = current_worker();
+    if (index < 0)
+        index = next_queue++ % size();
+    pending++;
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->tasks.push_back(task);
+    }
+    queued++;
+    // take the sleep lock so a worker that just found nothing to do cannot miss this wake up
+    std::lock_guard<std::mutex> guard(sleep_lock);
+    work_available.notify_one();
+}
+
+void thread_pool::wait() {
+    std::unique_lock<std::mutex> guard(sleep_lock);
+    while (pending > 0)
+        all_done.wait(guard);
+}
+
+// take the newest task of the own deque, or steal the oldest task of another worker
+bool thread_pool::take(int index, std::function<void()> &task) {
+    {
+        worker_queue &own = *queues[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    for (int i = 1; i < size(); i++) {
+        worker_queue &victim = *queues[(index + i) % size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the loop of a worker thread
+void thread_pool::run(int index) {
+    current_worker() = index;
+    std::function<void()> task;
+    for (;;) {
+        if (take(index, task)) {
+            task();
+            task = std::function<void()>();
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> guard(sleep_lock);
+                all_done.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        if (stopping)
+            return;
+        // queued is raised before the sleep lock is taken to notify, so checking it here never misses a task
+        if (queued == 0)
+            work_available.wait(guard);
+    }
+}
+
+#endif //THREAD_POOL_H
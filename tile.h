@@ -0,0 +1,34 @@
+// This file contains the tiles the image is cut into for rendering
+// Tiles are small, so the slow parts of the image (e.g. behind the glass pillar) are spread over all workers
+
+#ifndef TILE_H
+#define TILE_H
+
+#include <vector>
+
+// a rectangle of pixels, x in [x0, x1) and y in [y0, y1)
+struct tile {
+    int x0, y0, x1, y1;
+
+    int width() const { return x1 - x0; }
+
+    int height() const { return y1 - y0; }
+};
+
+// cut the rectangle [x0, x1) x [y0, y1) into tiles of at most size x size pixels, top rows first
+std::vector<tile> make_tiles(int x0, int y0, int x1, int y1, int size) {
+    std::vector<tile> tiles;
+    for (int y = y1; y > y0; y -= size) {
+        for (int x = x0; x < x1; x += size) {
+            tile t;
+            t.x0 = x;
+            t.x1 = x + size < x1 ? x + size : x1;
+            t.y0 = y - size > y0 ? y - size : y0;
+            t.y1 = y;
+            tiles.push_back(t);
+        }
+    }
+    return tiles;
+}
+
+#endif //TILE_H
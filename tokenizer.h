@@ -0,0 +1,115 @@
+// This file contains the tokenizer of the text files the renderer reads, scene files and OBJ meshes
+// A file is read through a large buffer one line at a time, and a line is split into tokens at blanks. Everything
+// after a # is a comment. Nothing of the text is kept, so files of any size are read in constant memory
+
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stdio.h>
+#include <string>
+
+// splits a file into lines and the lines into tokens, reading it through a buffer
+class text_tokenizer {
+public:
+    explicit text_tokenizer(FILE *f) : file(f), buffer(new char[buffer_size]), pos(0), len(0), line(0),
+                                       ended(true), repeat(false), last(NULL) {}
+
+    ~text_tokenizer() { delete[] buffer; }
+
+    // move to the next line that holds a token, skipping what is left of the current one. false at the end of the file
+    bool next_line();
+
+    // the next token of the line, NULL at its end. Valid until the next call
+    const char *next();
+
+    // let the next call of next() return the last token again
+    void put_back() { repeat = last != NULL; }
+
+    int line_number() const { return line; }
+
+    // reading the file failed, rather than coming to its end
+    bool failed() const { return ferror(file) != 0; }
+
+    static const size_t buffer_size = 1 << 20;
+
+private:
+    text_tokenizer(const text_tokenizer &);
+
+    text_tokenizer &operator=(const text_tokenizer &);
+
+    // the next character, EOF at the end of the file
+    int get() {
+        if (pos == len) {
+            len = fread(buffer, 1, buffer_size, file);
+            pos = 0;
+            if (len == 0)
+                return EOF;
+        }
+        return static_cast<unsigned char>(buffer[pos++]);
+    }
+
+    FILE *file;
+    char *buffer;
+    size_t pos, len;
+    int line;
+    bool ended;         // the end of the current line has been read
+    bool repeat;        // see put_back()
+    const char *last;   // the token next() returned last
+    std::string token;  // grows to the longest token, e.g. a long mesh path, and keeps its memory
+};
+
+bool text_tokenizer::next_line() {
+    while (!ended) {
+        int c = get();
+        if (c == '\n' || c == EOF)
+            ended = true;
+    }
+    for (;;) {
+        if (pos == len) {
+            len = fread(buffer, 1, buffer_size, file);
+            pos = 0;
+            if (len == 0)
+                return false;
+        }
+        line++;
+        ended = false;
+        repeat = false;
+        if (next() != NULL) {
+            repeat = true;
+            return true;
+        }
+    }
+}
+
+const char *text_tokenizer::next() {
+    if (repeat) {
+        repeat = false;
+        return last;
+    }
+    last = NULL;
+    if (ended)
+        return NULL;
+    int c = get();
+    while (c == ' ' || c == '\t' || c == '\r')
+        c = get();
+    if (c == '#') {
+        while (c != '\n' && c != EOF)
+            c = get();
+    }
+    if (c == '\n' || c == EOF) {
+        ended = true;
+        return NULL;
+    }
+    token.clear();
+    while (c != EOF && c != ' ' && c != '\t' && c != '\r' && c != '\n' && c != '#') {
+        token += char(c);
+        c = get();
+    }
+    // the character after the token belongs to what follows. It was just read from the buffer, so it is still there
+    if (c != EOF)
+        pos--;
+    last = token.c_str();
+    return last;
+}
+
+#endif //TOKENIZER_H
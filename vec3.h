@@ -9,27 +9,63 @@
 
 //
 // This is a standard implementation of 3D vectors. Adopted from textbook *Ray tracing in one weekend*
+// By default a vec3 is three plain floats. With VEC3_SIMD defined, and SSE available, it is held in one 128 bit
+// register with a 4th padding lane, so every operation is a single instruction. Every lane is computed with the same
+// operations in the same order, so both give the same results unless the compiler fuses multiplies and adds
 //
 
+#if defined(VEC3_SIMD) && (defined(__SSE__) || defined(_M_X64))
+#include <immintrin.h>
+#define VEC3_SSE
+#endif
+
 class vec3 {
 public:
+#ifdef VEC3_SSE
+    // the padding lane must never hold garbage: a denormal there slows down every operation on the vector
+    vec3() : m(_mm_setzero_ps()) {}
+#else
     vec3() {}
+#endif
 
     vec3(float e0, float e1, float e2) {
+#ifdef VEC3_SSE
+        m = _mm_set_ps(0, e2, e1, e0);
+#else
         e[0] = e0;
         e[1] = e1;
         e[2] = e2;
+#endif
     } //constructor (x,y,z)
 
+#ifdef VEC3_SSE
+
+    explicit vec3(__m128 v) : m(v) {}
+
+#endif
+
+#ifdef VEC3_SSE
+
+    // read a lane in the register, without a round trip through memory
+    inline float x() const { return _mm_cvtss_f32(m); }
+
+    inline float y() const { return _mm_cvtss_f32(_mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1))); }
+
+    inline float z() const { return _mm_cvtss_f32(_mm_movehl_ps(m, m)); }
+
+#else
+
     inline float x() const { return e[0]; }
 
     inline float y() const { return e[1]; }
 
     inline float z() const { return e[2]; }
 
+#endif
+
     inline const vec3 &operator+() const { return *this; }
 
-    inline vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+    inline vec3 operator-() const;
 
     inline float operator[](int i) const { return e[i]; }
 
@@ -47,10 +83,16 @@ public:
 
     inline vec3 &operator/=(const float t);
 
-    inline float length() const { return sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]); }
-
+    inline float length() const;
 
+#ifdef VEC3_SSE
+    union {
+        __m128 m;
+        float e[4];  // x, y, z and the padding lane
+    };
+#else
     float e[3];
+#endif
 };
 
 
@@ -66,6 +108,101 @@ inline std::ostream &operator<<(std::ostream &os, const vec3 &t) {
     return os;
 }
 
+#ifdef VEC3_SSE
+
+// x, y and z of v with a zero padding lane. A division by a vector needs it, the two padding lanes divide 0 / 0
+inline __m128 vec3_clear_padding(__m128 v) {
+    return _mm_movelh_ps(v, _mm_unpackhi_ps(v, _mm_setzero_ps()));
+}
+
+// negate by flipping the sign bits
+inline vec3 vec3::operator-() const { return vec3(_mm_xor_ps(m, _mm_set1_ps(-0.0f))); }
+
+//overload operator plus
+inline vec3 operator+(const vec3 &v1, const vec3 &v2) { return vec3(_mm_add_ps(v1.m, v2.m)); }
+
+//overload operator minus
+inline vec3 operator-(const vec3 &v1, const vec3 &v2) { return vec3(_mm_sub_ps(v1.m, v2.m)); }
+
+//overload operator multiply (vector multiplication)
+inline vec3 operator*(const vec3 &v1, const vec3 &v2) { return vec3(_mm_mul_ps(v1.m, v2.m)); }
+
+//overload operator divide (vector division)
+inline vec3 operator/(const vec3 &v1, const vec3 &v2) {
+    return vec3(vec3_clear_padding(_mm_div_ps(v1.m, v2.m)));
+}
+
+//overload operator multiply (scalar multiplication)
+inline vec3 operator*(float t, const vec3 &v) { return vec3(_mm_mul_ps(_mm_set1_ps(t), v.m)); }
+
+//overload operator divide (scalar division)
+inline vec3 operator/(const vec3 &v, float t) { return vec3(_mm_div_ps(v.m, _mm_set1_ps(t))); }
+
+//overload operator multiply (scalar multiplication)
+inline vec3 operator*(const vec3 &v, float t) { return vec3(_mm_mul_ps(_mm_set1_ps(t), v.m)); }
+
+//overload operator plus-assign
+inline vec3 &vec3::operator+=(const vec3 &v) {
+    m = _mm_add_ps(m, v.m);
+    return *this;
+}
+
+//overload operator multiply-assign (vector multiplication)
+inline vec3 &vec3::operator*=(const vec3 &v) {
+    m = _mm_mul_ps(m, v.m);
+    return *this;
+}
+
+//overload operator divide-assign
+inline vec3 &vec3::operator/=(const vec3 &v) {
+    m = vec3_clear_padding(_mm_div_ps(m, v.m));
+    return *this;
+}
+
+//overload operator minus-assign
+inline vec3 &vec3::operator-=(const vec3 &v) {
+    m = _mm_sub_ps(m, v.m);
+    return *this;
+}
+
+//overload operator multiply-assign (scalar multiplication)
+inline vec3 &vec3::operator*=(const float t) {
+    m = _mm_mul_ps(m, _mm_set1_ps(t));
+    return *this;
+}
+
+//overload operator divide-assign (scalar division)
+inline vec3 &vec3::operator/=(const float t) {
+    float k = 1.0 / t;
+
+    m = _mm_mul_ps(m, _mm_set1_ps(k));
+    return *this;
+}
+
+//compute dot product on two vectors
+// the products are added x + y first, then z, like the scalar version
+inline float dot(const vec3 &v1, const vec3 &v2) {
+    __m128 p = _mm_mul_ps(v1.m, v2.m);
+    __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(p, y), z));
+}
+
+//compute cross product on two vectors
+// (y1 z2 - z1 y2, z1 x2 - x1 z2, x1 y2 - y1 x2) from two rotations of the lanes
+inline vec3 cross(const vec3 &v1, const vec3 &v2) {
+    __m128 a_yzx = _mm_shuffle_ps(v1.m, v1.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 a_zxy = _mm_shuffle_ps(v1.m, v1.m, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 b_yzx = _mm_shuffle_ps(v2.m, v2.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_zxy = _mm_shuffle_ps(v2.m, v2.m, _MM_SHUFFLE(3, 1, 0, 2));
+    return vec3(_mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx)));
+}
+
+#else
+
+// negate every component
+inline vec3 vec3::operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+
 //overload operator plus
 inline vec3 operator+(const vec3 &v1, const vec3 &v2) {
     return vec3(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2]);
@@ -92,7 +229,7 @@ inline vec3 operator*(float t, const vec3 &v) {
 }
 
 //overload operator divide (scalar division)
-inline vec3 operator/(vec3 v, float t) {
+inline vec3 operator/(const vec3 &v, float t) {
     return vec3(v.e[0] / t, v.e[1] / t, v.e[2] / t);
 }
 
@@ -164,8 +301,13 @@ inline vec3 cross(const vec3 &v1, const vec3 &v2) {
                 (v1.e[0] * v2.e[1] - v1.e[1] * v2.e[0]));
 }
 
+#endif
+
+// length of the vector
+inline float vec3::length() const { return sqrt(dot(*this, *this)); }
+
 //compute the unit vector in the direction of that vector
-inline vec3 unit_vector(vec3 v) {
+inline vec3 unit_vector(const vec3 &v) {
     return v / v.length();
 }
 
@@ -0,0 +1,355 @@
+// This file contains the wavefront renderer, a second way of running the path integrator of integrator.h
+// Instead of following one path to its end, a whole batch of paths (every sample of a tile's batch) advances one
+// bounce at a time, in stages that each run one tight loop over a queue:
+//   generate: camera rays for every pixel that still needs samples
+//   extend:   the closest hit of every ray in the queue. Camera rays are traced in packets (packet.h), the
+//             bounces after them are too incoherent and are traced one at a time
+//   shade:    the hits, grouped by material kind, so each group runs one material's code without virtual calls.
+//             Shading adds emission, queues a shadow ray towards a light and queues the next bounce
+//   connect:  the shadow rays, adding the light they reach. Those from the camera hits are traced in packets
+// Rays are kept as a structure of arrays. Every path keeps its own random sequence and draws from it in the same
+// order as color() does, so both renderers produce the same image, up to the rounding of the packet kernels when the
+// compiler fuses their multiplies and adds differently
+// See *Megakernels Considered Harmful: Wavefront Path Tracing on GPUs* by Laine, Karras and Aila
+
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <vector>
+#include "hitable.h"
+#include "material.h"
+#include "sampler.h"
+#include "render.h"
+
+// rays as a structure of arrays, each with the path it belongs to
+struct ray_queue {
+    int size() const { return int(path.size()); }
+
+    void clear();
+
+    void push(const ray &r, int p);
+
+    ray get(int i) const {
+        return ray(vec3(origin_x[i], origin_y[i], origin_z[i]), vec3(direction_x[i], direction_y[i], direction_z[i]),
+                   time[i]);
+    }
+
+    std::vector<float> origin_x, origin_y, origin_z;
+    std::vector<float> direction_x, direction_y, direction_z;
+    std::vector<float> time;
+    std::vector<int> path;
+};
+
+void ray_queue::clear() {
+    origin_x.clear();
+    origin_y.clear();
+    origin_z.clear();
+    direction_x.clear();
+    direction_y.clear();
+    direction_z.clear();
+    time.clear();
+    path.clear();
+}
+
+void ray_queue::push(const ray &r, int p) {
+    origin_x.push_back(r.A.x());
+    origin_y.push_back(r.A.y());
+    origin_z.push_back(r.A.z());
+    direction_x.push_back(r.B.x());
+    direction_y.push_back(r.B.y());
+    direction_z.push_back(r.B.z());
+    time.push_back(r.time());
+    path.push_back(p);
+}
+
+// the closest hits of the n rays of q from begin on, traced as one packet, with their records filled in
+// lanes past n repeat the last ray so every lane holds a valid ray, but they are left out of the mask
+int trace_packet(hitable *world, const ray_queue &q, int begin, int n, packet_hits &h) {
+    ray_packet p;
+    for (int l = 0; l < packet_size; l++) {
+        p.set(l, q.get(begin + (l < n ? l : n - 1)));
+        h.t[l] = MAXFLOAT;
+    }
+    int found = world->hit_packet(p, (1 << n) - 1, 0.001, h);
+    complete_packet(p, found, h);
+    return found;
+}
+
+// shadow rays, with what the light they reach is multiplied by before it is added to their path
+struct shadow_queue : ray_queue {
+    void clear() {
+        ray_queue::clear();
+        f.clear();
+        scale.clear();
+        throughput.clear();
+    }
+
+    std::vector<vec3> f;            // eval() of the material towards the light
+    std::vector<float> scale;       // MIS weight over the density of the light sample
+    std::vector<vec3> throughput;   // throughput of the path at the hit the shadow ray starts from
+};
+
+// calls to the material of a shade group. They are qualified, so the compiler resolves and can inline them
+template<class M>
+struct material_calls {
+    static bool sample(const material *m, const ray &r_in, const hit_record &rec, sampler &rng,
+                       scatter_record &srec) {
+        return static_cast<const M *>(m)->M::sample(r_in, rec, rng, srec);
+    }
+
+    static vec3 eval(const material *m, const ray &r_in, const hit_record &rec, const vec3 &wi) {
+        return static_cast<const M *>(m)->M::eval(r_in, rec, wi);
+    }
+
+    static float pdf(const material *m, const ray &r_in, const hit_record &rec, const vec3 &wi) {
+        return static_cast<const M *>(m)->M::pdf(r_in, rec, wi);
+    }
+
+    static bool is_delta(const material *m) { return static_cast<const M *>(m)->M::is_delta(); }
+
+    static vec3 emitted(const material *m, float u, float v, const vec3 &p) {
+        return static_cast<const M *>(m)->M::emitted(u, v, p);
+    }
+};
+
+// materials of kinds the renderer does not know go through the virtual functions
+template<>
+struct material_calls<material> {
+    static bool sample(const material *m, const ray &r_in, const hit_record &rec, sampler &rng,
+                       scatter_record &srec) {
+        return m->sample(r_in, rec, rng, srec);
+    }
+
+    static vec3 eval(const material *m, const ray &r_in, const hit_record &rec, const vec3 &wi) {
+        return m->eval(r_in, rec, wi);
+    }
+
+    static float pdf(const material *m, const ray &r_in, const hit_record &rec, const vec3 &wi) {
+        return m->pdf(r_in, rec, wi);
+    }
+
+    static bool is_delta(const material *m) { return m->is_delta(); }
+
+    static vec3 emitted(const material *m, float u, float v, const vec3 &p) { return m->emitted(u, v, p); }
+};
+
+// light emitted by the material of a hit, without a virtual call for the built-in kinds
+inline vec3 material_emitted(const hit_record &rec) {
+    switch (rec.mat_ptr->kind) {
+        case MATERIAL_DIFFUSE_LIGHT:
+            return material_calls<diffuse_light>::emitted(rec.mat_ptr, rec.u, rec.v, rec.p);
+        case MATERIAL_OTHER:
+            return rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        default:
+            return vec3(0, 0, 0);
+    }
+}
+
+// the queues and path states of one thread
+class wavefront_renderer {
+public:
+    // render a tile in waves, each wave is the next batch of samples of every pixel that is not done yet
+    // estimates holds the tile's pixels row by row, starting at (x0, y0)
+    void render(const render_context &ctx, const tile &t, std::vector<pixel_estimate> &estimates);
+
+private:
+    // follow the queued camera rays until every path has ended
+    void trace(const render_context &ctx);
+
+    // trace the current rays, in packets when they are coherent
+    void extend(const render_context &ctx, bool coherent);
+
+    // shade the hits in group with the material M. Only emitting kinds look at emission
+    template<class M, bool emits>
+    void shade(const render_context &ctx, const std::vector<int> &group, int depth);
+
+    // trace the shadow rays, in packets when they are coherent
+    void connect(const render_context &ctx, bool coherent);
+
+    // paths
+    std::vector<int> pixel;   // index of the pixel in the tile's estimates
+    std::vector<sampler> rng;
+    std::vector<vec3> radiance;
+    std::vector<vec3> throughput;
+    std::vector<vec3> previous_p;
+    std::vector<float> previous_pdf;
+    std::vector<char> previous_sampled_lights;
+
+    // the rays of the current bounce, their hits and the rays of the next bounce
+    ray_queue current, next;
+    std::vector<hit_record> hits;
+    std::vector<int> groups[MATERIAL_KIND_COUNT];
+    shadow_queue shadows;
+};
+
+void wavefront_renderer::render(const render_context &ctx, const tile &t, std::vector<pixel_estimate> &estimates) {
+    for (;;) {
+        // generate: the paths are created pixel by pixel, sample by sample, which is also the order they are
+        // added to the estimates in, so the result is the one of render_tile_path()
+        pixel.clear();
+        rng.clear();
+        current.clear();
+        for (int j = t.y1 - 1; j >= t.y0; j--) {
+            for (int i = t.x0; i < t.x1; i++) {
+                int index = (j - t.y0) * t.width() + (i - t.x0);
+                pixel_estimate &estimate = estimates[index];
+                if (estimate.done(ctx.adaptive))
+                    continue;
+                for (int b = 0; b < ctx.adaptive.batch && estimate.samples + b < ctx.adaptive.max_samples; b++) {
+                    sampler path_rng;
+                    ray r = camera_sample(ctx, i, j, estimate.samples + b, path_rng);
+                    current.push(r, int(pixel.size()));
+                    pixel.push_back(index);
+                    rng.push_back(path_rng);
+                }
+            }
+        }
+        if (pixel.empty())
+            break;
+
+        trace(ctx);
+
+        for (size_t p = 0; p < pixel.size(); p++)
+            estimates[pixel[p]].add(de_nan(radiance[p]));
+    }
+}
+
+void wavefront_renderer::trace(const render_context &ctx) {
+    size_t n = pixel.size();
+    radiance.assign(n, vec3(0, 0, 0));
+    throughput.assign(n, vec3(1, 1, 1));
+    previous_p.resize(n);
+    previous_pdf.assign(n, 0);
+    previous_sampled_lights.assign(n, 0);
+    // all paths start together, so the depth is the same for every ray in the queue
+    for (int depth = 0; current.size() > 0; depth++) {
+        extend(ctx, depth == 0);
+        next.clear();
+        shadows.clear();
+        shade<lambertian, false>(ctx, groups[MATERIAL_LAMBERTIAN], depth);
+        shade<metal, false>(ctx, groups[MATERIAL_METAL], depth);
+        shade<dielectric, false>(ctx, groups[MATERIAL_DIELECTRIC], depth);
+        shade<diffuse_light, true>(ctx, groups[MATERIAL_DIFFUSE_LIGHT], depth);
+        shade<isotropic, false>(ctx, groups[MATERIAL_ISOTROPIC], depth);
+        shade<material, true>(ctx, groups[MATERIAL_OTHER], depth);
+        connect(ctx, depth == 0);
+        std::swap(current, next);
+    }
+}
+
+// find the closest hits and group them by material kind. Rays that leave the scene end their path
+void wavefront_renderer::extend(const render_context &ctx, bool coherent) {
+    int n = current.size();
+    hits.resize(n);
+    for (int k = 0; k < MATERIAL_KIND_COUNT; k++)
+        groups[k].clear();
+    if (coherent) {
+        for (int k = 0; k < n; k += packet_size) {
+            int count = n - k < packet_size ? n - k : packet_size;
+            packet_hits h;
+            int found = trace_packet(ctx.world, current, k, count, h);
+            for (int l = 0; l < count; l++) {
+                if (found & (1 << l)) {
+                    hits[k + l] = h.rec[l];
+                    groups[h.rec[l].mat_ptr->kind].push_back(k + l);
+                }
+            }
+        }
+        return;
+    }
+    for (int k = 0; k < n; k++) {
+        if (closest_hit(ctx.world, current.get(k), 0.001, MAXFLOAT, hits[k]))
+            groups[hits[k].mat_ptr->kind].push_back(k);
+    }
+}
+
+template<class M, bool emits>
+void wavefront_renderer::shade(const render_context &ctx, const std::vector<int> &group, int depth) {
+    typedef material_calls<M> calls;
+    for (size_t g = 0; g < group.size(); g++) {
+        int k = group[g];
+        int p = current.path[k];
+        const hit_record &rec = hits[k];
+        const material *mat = rec.mat_ptr;
+        ray r_in = current.get(k);
+        if (emits) {
+            vec3 emitted = calls::emitted(mat, rec.u, rec.v, rec.p);
+            if (emitted.x() > 0 || emitted.y() > 0 || emitted.z() > 0) {
+                float weight = 1;
+                if (previous_sampled_lights[p])
+                    weight = power_heuristic(previous_pdf[p], ctx.lights->pdf_value(previous_p[p], r_in.direction()));
+                radiance[p] += throughput[p] * emitted * weight;
+            }
+        }
+        if (depth >= ctx.paths.max_depth)
+            continue;
+        // the shadow ray is only queued here and traced by connect(), the same checks as in direct_light()
+        bool sample_lights = ctx.lights != NULL && !calls::is_delta(mat);
+        if (sample_lights) {
+            vec3 to_light = ctx.lights->random(rec.p, rng[p]);
+            float light_pdf = ctx.lights->pdf_value(rec.p, to_light);
+            if (light_pdf > 0) {
+                vec3 f = calls::eval(mat, r_in, rec, to_light);
+                if (f.x() > 0 || f.y() > 0 || f.z() > 0) {
+                    shadows.push(ray(rec.p, to_light, r_in.time()), p);
+                    shadows.f.push_back(f);
+                    shadows.scale.push_back(power_heuristic(light_pdf, calls::pdf(mat, r_in, rec, to_light)) / light_pdf);
+                    shadows.throughput.push_back(throughput[p]);
+                }
+            }
+        }
+        scatter_record srec;
+        if (!calls::sample(mat, r_in, rec, rng[p], srec))
+            continue;
+        throughput[p] *= srec.attenuation;
+        previous_p[p] = rec.p;
+        previous_sampled_lights[p] = sample_lights;
+        previous_pdf[p] = srec.pdf;
+        // Russian roulette, as in color()
+        if (depth + 1 >= ctx.paths.rr_depth) {
+            vec3 &t = throughput[p];
+            float survival = fmax(t.x(), fmax(t.y(), t.z()));
+            survival = survival < rr_max_survival ? survival : rr_max_survival;
+            if (rng[p].next() >= survival)
+                continue;
+            t /= survival;
+        }
+        next.push(srec.scattered, p);
+    }
+}
+
+// trace the shadow rays, whatever they hit first is the light they see
+// the shadow rays from the camera hits of a pixel's samples start close together and all aim at the lights, so they
+// go in packets. Later shadow rays start all over the scene and are traced one at a time
+void wavefront_renderer::connect(const render_context &ctx, bool coherent) {
+    int n = shadows.size();
+    if (!coherent) {
+        for (int k = 0; k < n; k++) {
+            hit_record light_rec;
+            if (!closest_hit(ctx.world, shadows.get(k), 0.001, MAXFLOAT, light_rec))
+                continue;
+            vec3 direct = shadows.f[k] * material_emitted(light_rec) * shadows.scale[k];
+            radiance[shadows.path[k]] += shadows.throughput[k] * direct;
+        }
+        return;
+    }
+    for (int k = 0; k < n; k += packet_size) {
+        int count = n - k < packet_size ? n - k : packet_size;
+        packet_hits h;
+        int found = trace_packet(ctx.world, shadows, k, count, h);
+        for (int l = 0; l < count; l++) {
+            if (!(found & (1 << l)))
+                continue;
+            vec3 direct = shadows.f[k + l] * material_emitted(h.rec[l]) * shadows.scale[k + l];
+            radiance[shadows.path[k + l]] += shadows.throughput[k + l] * direct;
+        }
+    }
+}
+
+// render a tile with the wavefront renderer of the calling thread
+void render_tile_wavefront(const render_context &ctx, const tile &t, std::vector<pixel_estimate> &estimates) {
+    static thread_local wavefront_renderer renderer;
+    renderer.render(ctx, t, estimates);
+}
+
+#endif //WAVEFRONT_H
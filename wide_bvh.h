@@ -0,0 +1,359 @@
+// This file contains the wide bvh, where every node has up to 4 (BVH4) or 8 (BVH8) children
+// The boxes of the children are stored as structure of arrays, so one ray is tested against all children at once
+// with SSE (4 wide) or AVX2 (8 wide). Without those instruction sets the same layout is tested with a scalar loop
+// The tree is made by collapsing the binary linear_bvh, so both share the same leaves and primitive order
+// Refer to the documentation for technical and mathematical details
+
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <vector>
+#include "linear_bvh.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define WIDE_BVH_SSE
+#endif
+#if defined(__AVX2__)
+#define WIDE_BVH_AVX2
+#endif
+
+// a node of the wide bvh
+template<int W>
+struct wide_bvh_node {
+    float bounds[6][W];     // min x, min y, min z, max x, max y, max z of every child
+    int child[W];           // interior child: index of its node. leaf child: index of its first primitive
+    int count[W];           // number of primitives of a leaf child, 0 for an interior child, -1 for an empty slot
+};
+
+// per ray data of the wide traversal, computed once per ray
+struct wide_bvh_ray {
+    wide_bvh_ray() {}
+
+    wide_bvh_ray(const ray &r) {
+        for (int a = 0; a < 3; a++) {
+            origin[a] = r.origin()[a];
+            inv_dir[a] = 1.0f / r.direction()[a];
+            // rows of wide_bvh_node::bounds holding the near and the far plane on this axis
+            near_row[a] = inv_dir[a] < 0 ? a + 3 : a;
+            far_row[a] = inv_dir[a] < 0 ? a : a + 3;
+        }
+    }
+
+    float origin[3];
+    float inv_dir[3];
+    int near_row[3];
+    int far_row[3];
+};
+
+// scalar slab test of all children. Returns a bit mask of the children hit and their entry distances in t_near
+template<int W>
+inline int wide_bvh_hit_children(const wide_bvh_node<W> &node, const wide_bvh_ray &r, float t_min, float t_max,
+                                 float *t_near) {
+    int mask = 0;
+    for (int i = 0; i < W; i++) {
+        float t0 = t_min;
+        float t1 = t_max;
+        for (int a = 0; a < 3; a++) {
+            float n = (node.bounds[r.near_row[a]][i] - r.origin[a]) * r.inv_dir[a];
+            float f = (node.bounds[r.far_row[a]][i] - r.origin[a]) * r.inv_dir[a] * aabb_far_scale;
+            t0 = n > t0 ? n : t0;
+            t1 = f < t1 ? f : t1;
+        }
+        t_near[i] = t0;
+        if (t0 <= t1)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+#ifdef WIDE_BVH_SSE
+
+// SSE slab test of 4 children at once
+// max/min return their second operand when the first is NaN, so a NaN from 0 * inf never widens the interval
+template<>
+inline int wide_bvh_hit_children<4>(const wide_bvh_node<4> &node, const wide_bvh_ray &r, float t_min, float t_max,
+                                    float *t_near) {
+    __m128 t0 = _mm_set1_ps(t_min);
+    __m128 t1 = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m128 o = _mm_set1_ps(r.origin[a]);
+        __m128 inv = _mm_set1_ps(r.inv_dir[a]);
+        __m128 inv_far = _mm_set1_ps(r.inv_dir[a] * aabb_far_scale);
+        __m128 n = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[r.near_row[a]]), o), inv);
+        __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[r.far_row[a]]), o), inv_far);
+        t0 = _mm_max_ps(n, t0);
+        t1 = _mm_min_ps(f, t1);
+    }
+    _mm_storeu_ps(t_near, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+#endif
+
+#ifdef WIDE_BVH_AVX2
+
+// AVX2 slab test of 8 children at once
+template<>
+inline int wide_bvh_hit_children<8>(const wide_bvh_node<8> &node, const wide_bvh_ray &r, float t_min, float t_max,
+                                    float *t_near) {
+    __m256 t0 = _mm256_set1_ps(t_min);
+    __m256 t1 = _mm256_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m256 o = _mm256_set1_ps(r.origin[a]);
+        __m256 inv = _mm256_set1_ps(r.inv_dir[a]);
+        __m256 inv_far = _mm256_set1_ps(r.inv_dir[a] * aabb_far_scale);
+        __m256 n = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bounds[r.near_row[a]]), o), inv);
+        __m256 f = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bounds[r.far_row[a]]), o), inv_far);
+        t0 = _mm256_max_ps(n, t0);
+        t1 = _mm256_min_ps(f, t1);
+    }
+    _mm256_storeu_ps(t_near, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+
+#endif
+
+// the wide bvh over a list of hitables
+template<int W>
+class wide_bvh : public hitable {
+public:
+    wide_bvh() : node_array(NULL), node_count(0) {}
+
+    // constructor. Builds a binary linear_bvh over the n hitables in l, on threads if it is not NULL, and collapses it
+    wide_bvh(hitable **l, int n, float time0, float time1, bvh_builder builder = default_bvh_builder,
+             thread_pool *threads = NULL);
+
+    // constructor. Traverses count nodes built before, which stay where they are and must outlive the tree, over the
+    // n hitables in l in leaf order. Used for the trees of a mapped scene cache
+    wide_bvh(const wide_bvh_node<W> *tree, int count, hitable **l, int n, const aabb &bounds)
+            : node_array(tree), node_count(count), primitives(l, l + n), box(bounds) {}
+
+    virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
+
+    virtual int hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const;
+
+    virtual bool bounding_box(float t0, float t1, aabb &b) const {
+        b = box;
+        return node_count > 0;
+    }
+
+    // bytes of the node and primitive arrays
+    size_t memory() const {
+        return nodes.capacity() * sizeof(wide_bvh_node<W>) + primitives.capacity() * sizeof(hitable *);
+    }
+
+    std::vector<wide_bvh_node<W> > nodes;   // the nodes built by the tree, empty when they live elsewhere
+    const wide_bvh_node<W> *node_array;     // the nodes traversed: nodes, or those given to the constructor
+    int node_count;
+    std::vector<hitable *> primitives;      // primitives in leaf order
+    aabb box;
+    bvh_build_stats stats;                  // how the binary tree was built, all zero for nodes built before
+
+private:
+    wide_bvh(const wide_bvh &);
+
+    wide_bvh &operator=(const wide_bvh &);
+
+    int collapse(const std::vector<linear_bvh_node> &binary, int index);
+};
+
+template<int W>
+wide_bvh<W>::wide_bvh(hitable **l, int n, float time0, float time1, bvh_builder builder, thread_pool *threads)
+        : node_array(NULL), node_count(0) {
+    linear_bvh binary(l, n, time0, time1, builder, threads);
+    stats = binary.stats;
+    if (binary.nodes.empty())
+        return;
+    box = linear_bvh_bounds(binary.nodes[0]);
+    primitives = binary.primitives;
+    nodes.reserve(binary.nodes.size() / (W - 1) + 1);
+    collapse(binary.nodes, 0);
+    node_array = &nodes[0];
+    node_count = int(nodes.size());
+}
+
+// turn the binary subtree rooted at index into a wide node. Returns the index of the new node
+// the children are found by repeatedly opening the interior child with the largest surface area
+template<int W>
+int wide_bvh<W>::collapse(const std::vector<linear_bvh_node> &binary, int index) {
+    int children[W];
+    int n = 0;
+    if (binary[index].count > 0) {
+        children[n++] = index;
+    } else {
+        children[n++] = index + 1;
+        children[n++] = binary[index].offset;
+    }
+    while (n < W) {
+        int largest = -1;
+        float largest_area = -1;
+        for (int i = 0; i < n; i++) {
+            const linear_bvh_node &c = binary[children[i]];
+            float area = linear_bvh_bounds(c).area();
+            if (c.count == 0 && area > largest_area) {
+                largest = i;
+                largest_area = area;
+            }
+        }
+        if (largest < 0)
+            break;
+        int opened = children[largest];
+        children[largest] = opened + 1;
+        children[n++] = binary[opened].offset;
+    }
+
+    int result = nodes.size();
+    nodes.push_back(wide_bvh_node<W>());
+    for (int i = 0; i < W; i++) {
+        if (i < n) {
+            const linear_bvh_node &c = binary[children[i]];
+            for (int a = 0; a < 3; a++) {
+                nodes[result].bounds[a][i] = c.bounds_min[a];
+                nodes[result].bounds[a + 3][i] = c.bounds_max[a];
+            }
+            nodes[result].count[i] = c.count;
+            nodes[result].child[i] = c.offset;
+        } else {
+            // an empty slot has an inverted box that no ray can hit
+            for (int a = 0; a < 3; a++) {
+                nodes[result].bounds[a][i] = FLT_MAX;
+                nodes[result].bounds[a + 3][i] = -FLT_MAX;
+            }
+            nodes[result].count[i] = -1;
+            nodes[result].child[i] = -1;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (binary[children[i]].count == 0) {
+            int child = collapse(binary, children[i]);
+            nodes[result].child[i] = child;
+        }
+    }
+    return result;
+}
+
+// compute whether the ray hits anything in the tree
+// children are pushed far to near so the nearest one is visited first, and skipped when a closer hit was found
+template<int W>
+bool wide_bvh<W>::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
+    if (node_count == 0)
+        return false;
+    wide_bvh_ray wr(r);
+    struct entry {
+        int node;
+        float t;
+    };
+    entry stack[linear_bvh_stack_size * W];
+    int top = 0;
+    stack[top].node = 0;
+    stack[top++].t = t_min;
+    bool hit_anything = false;
+    linear_bvh_leaf leaf(&primitives[0], r, t_min, rec);
+    while (top > 0) {
+        entry e = stack[--top];
+        if (e.t > t_max)
+            continue;
+        const wide_bvh_node<W> &node = node_array[e.node];
+        float t_near[W];
+        int mask = wide_bvh_hit_children(node, wr, t_min, t_max, t_near);
+        // gather the interior children that were hit, sorted far to near
+        entry hits[W];
+        int n = 0;
+        for (int i = 0; i < W; i++) {
+            if (!(mask & (1 << i)))
+                continue;
+            if (node.count[i] > 0) {
+                if (leaf(node.child[i], node.count[i], t_max))
+                    hit_anything = true;
+            } else {
+                int j = n++;
+                while (j > 0 && hits[j - 1].t < t_near[i]) {
+                    hits[j] = hits[j - 1];
+                    j--;
+                }
+                hits[j].node = node.child[i];
+                hits[j].t = t_near[i];
+            }
+        }
+        for (int i = 0; i < n; i++)
+            stack[top++] = hits[i];
+    }
+    return hit_anything;
+}
+
+// compute which rays of the packet hit anything in the tree
+// every lane that reached a node tests all of its children at once, like hit() does, and a child is only entered
+// with the lanes that hit it. Interior children are visited near to far by the nearest entry of those lanes
+template<int W>
+int wide_bvh<W>::hit_packet(const ray_packet &p, int mask, float t_min, packet_hits &h) const {
+    if (node_count == 0)
+        return 0;
+    wide_bvh_ray lanes[packet_size];
+    for (int l = 0; l < packet_size; l++)
+        if (mask & (1 << l))
+            lanes[l] = wide_bvh_ray(p.get(l));
+    struct entry {
+        int node;
+        int mask;
+        float t;
+    };
+    entry stack[linear_bvh_stack_size * W];
+    int top = 0;
+    stack[top].node = 0;
+    stack[top].mask = mask;
+    stack[top++].t = t_min;
+    int result = 0;
+    while (top > 0) {
+        entry e = stack[--top];
+        // skip a node that is farther than the closest hit of every lane that would enter it
+        float t_max = t_min;
+        for (int l = 0; l < packet_size; l++)
+            if ((e.mask & (1 << l)) && h.t[l] > t_max)
+                t_max = h.t[l];
+        if (e.t > t_max)
+            continue;
+        const wide_bvh_node<W> &node = node_array[e.node];
+        // transpose the children hit by every lane into the lanes hitting every child
+        int child_mask[W];
+        float child_t[W];
+        for (int i = 0; i < W; i++) {
+            child_mask[i] = 0;
+            child_t[i] = MAXFLOAT;
+        }
+        for (int m = e.mask; m != 0; m &= m - 1) {
+            int l = __builtin_ctz(m);
+            float t_near[W];
+            int hit = wide_bvh_hit_children(node, lanes[l], t_min, h.t[l], t_near);
+            for (; hit != 0; hit &= hit - 1) {
+                int i = __builtin_ctz(hit);
+                child_mask[i] |= 1 << l;
+                child_t[i] = t_near[i] < child_t[i] ? t_near[i] : child_t[i];
+            }
+        }
+        entry hits[W];
+        int n = 0;
+        for (int i = 0; i < W; i++) {
+            if (child_mask[i] == 0)
+                continue;
+            if (node.count[i] > 0) {
+                for (int k = node.child[i]; k < node.child[i] + node.count[i]; k++)
+                    result |= primitives[k]->hit_packet(p, child_mask[i], t_min, h);
+            } else {
+                int j = n++;
+                while (j > 0 && hits[j - 1].t < child_t[i]) {
+                    hits[j] = hits[j - 1];
+                    j--;
+                }
+                hits[j].node = node.child[i];
+                hits[j].mask = child_mask[i];
+                hits[j].t = child_t[i];
+            }
+        }
+        for (int i = 0; i < n; i++)
+            stack[top++] = hits[i];
+    }
+    return result;
+}
+
+#endif //WIDE_BVH_H